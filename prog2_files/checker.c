@@ -0,0 +1,273 @@
+/* checker.c
+   The double-check checks, on Trace_Records.  See checker.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "jrb.h"
+#include "trace.h"
+#include "checker.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+typedef struct {
+  double time;
+  int id;
+  int door;
+  int floor;
+  int state;
+} Elevator;
+
+typedef struct {
+  int from;
+  int to;
+  Elevator *e;
+  int state;
+} Person;
+
+/* People are keyed by their number -- the n in "lname(n)" -- and names
+   are only made for error messages. */
+
+struct checker {
+  JRB people;
+  JRB elevators;
+  char *where;
+  char name[100];
+  char error[300];
+};
+
+Checker new_checker(char *where)
+{
+  Checker c;
+
+  c = talloc(struct checker, 1);
+  c->people = make_jrb();
+  c->elevators = make_jrb();
+  c->where = where;
+  c->error[0] = '\0';
+  return c;
+}
+
+void free_checker(Checker c)
+{
+  JRB tmp;
+
+  jrb_traverse(tmp, c->people) free(tmp->val.v);
+  jrb_free_tree(c->people);
+  jrb_traverse(tmp, c->elevators) free(tmp->val.v);
+  jrb_free_tree(c->elevators);
+  free(c);
+}
+
+char *checker_error(Checker c)
+{
+  return c->error;
+}
+
+static int fail(Checker c, long long n, char *fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  len = snprintf(c->error, sizeof(c->error), "%s %lld: ", c->where, n);
+  va_start(ap, fmt);
+  vsnprintf(c->error + len, sizeof(c->error) - len, fmt, ap);
+  va_end(ap);
+  return CHECK_ERROR;
+}
+
+static Elevator *get_elevator(Checker c, int id)
+{
+  Elevator *e;
+  JRB tmp;
+ 
+  tmp = jrb_find_int(c->elevators, id);
+  if (tmp != NULL) return (Elevator *) tmp->val.v;
+
+  e = talloc(Elevator, 1);
+  e->time = 0;
+  e->id = id;
+  e->door = 0;
+  e->floor = 1;
+  e->state = 'R';
+  jrb_insert_int(c->elevators, id, new_jval_v((void *) e));
+  return e;
+}
+
+/* The person's name: from the line of text, or made from the record. */
+
+static char *who(Checker c, Trace_Record *r, char *name)
+{
+  return (name != NULL) ? name : trace_name(r, c->name);
+}
+
+int checker_check(Checker c, Trace_Record *r, char *name, long long n)
+{
+  JRB tmp;
+  Elevator *e;
+  Person *p;
+  double t;
+
+  t = r->time / 1000000000.0;
+  switch (r->type) {
+    case TR_OPENING:
+      e = get_elevator(c, r->elevator);
+      if (e->door != 0) {
+        return fail(c, n, "Elevator %d opening a door that's already open", e->id);
+      }
+      if (e->state == 'O') {
+        return fail(c, n, "Elevator %d opening a door twice", e->id);
+      }
+      if (e->state == 'C') {
+        return fail(c, n, "Elevator %d opening a door that is closing", e->id);
+      }
+      e->state = 'O';
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_CLOSING:
+      e = get_elevator(c, r->elevator);
+      if (e->door != 1) {
+        return fail(c, n, "Elevator %d closing a door that's already closed", e->id);
+      }
+      if (e->state == 'C') {
+        return fail(c, n, "Elevator %d closing a door twice", e->id);
+      }
+      if (e->state == 'O') {
+        return fail(c, n, "Elevator %d closing a door that is opening", e->id);
+      }
+      e->state = 'C';
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_CLOSED:
+      e = get_elevator(c, r->elevator);
+      if (e->state != 'C') {
+        return fail(c, n, "Elevator %d closed a door that was not closing.", e->id);
+      }
+      e->state = 'R';
+      e->door = 0;
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_OPEN:
+      e = get_elevator(c, r->elevator);
+      if (e->state != 'O') {
+        return fail(c, n, "Elevator %d opened a door that was not opening.", e->id);
+      }
+      e->state = 'R';
+      e->door = 1;
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_MOVING:
+      e = get_elevator(c, r->elevator);
+      if (e->state != 'R') {
+        return fail(c, n, "Elevator %d moving from a non-rest state.", e->id);
+      }
+      if (e->door != 0) {
+        return fail(c, n, "Elevator %d moving when the door is open.", e->id);
+      }
+      if (r->floor != e->floor) {
+        return fail(c, n, "Elevator %d moving from a bad floor.", e->id);
+      }
+      e->floor = r->to;
+      e->state = 'M';
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_ARRIVES:
+      e = get_elevator(c, r->elevator);
+      if (e->state != 'M') {
+        return fail(c, n, "Elevator %d arriving from a non-moving state.", e->id);
+      }
+      if (e->door != 0) {
+        return fail(c, n, "Elevator %d arriving when the door is open.", e->id);
+      }
+      if (r->floor != e->floor) {
+        return fail(c, n, "Elevator %d arriving at the wrong floor (%d).", e->id, e->floor);
+      }
+      e->state = 'R';
+      e->time = t;
+      return CHECK_OK;
+
+    case TR_OVER:
+      return CHECK_OVER;
+
+    case TR_PERSON_ARRIVES:
+      if (jrb_find_int(c->people, r->person) != NULL) {
+        return fail(c, n, "Duplicate person %s", who(c, r, name));
+      }
+      p = talloc(Person, 1);
+      jrb_insert_int(c->people, r->person, new_jval_v((void *) p));
+      p->from = r->floor;
+      p->to = r->to;
+      p->state = 'A';
+      return CHECK_OK;
+  }
+
+  /* The rest are people who should already exist (CHECK_PERSON only that). */
+
+  tmp = jrb_find_int(c->people, r->person);
+  if (tmp == NULL) {
+    return fail(c, n, "Person %s doesn't exist", who(c, r, name));
+  }
+  p = (Person *) tmp->val.v;
+
+  switch (r->type) {
+    case TR_GETS_ON:
+      if (p->state != 'A') {
+        return fail(c, n, "Person %s not in arriving state when getting on an elevator", who(c, r, name));
+      }
+      if (r->floor != p->from) {
+        return fail(c, n, "Person %s not getting on the proper floor", who(c, r, name));
+      }
+      e = get_elevator(c, r->elevator);
+      if (e->floor != p->from) {
+        return fail(c, n, "Person %s getting on an elevator not on the right floor", who(c, r, name));
+      }
+      if (e->door != 1) {
+        return fail(c, n, "Person %s getting on an elevator whose door isn't open.", who(c, r, name));
+      }
+      if (e->state != 'R') {
+        return fail(c, n, "Person %s getting on an elevator who is not at rest.", who(c, r, name));
+      }
+      p->state = 'O';
+      p->e = e;
+      break;
+
+    case TR_GETS_OFF:
+      if (p->state != 'O') {
+        return fail(c, n, "Person %s not on the elevator when getting off", who(c, r, name));
+      }
+      if (r->floor != p->to) {
+        return fail(c, n, "Person %s not getting off on the proper floor", who(c, r, name));
+      }
+      e = get_elevator(c, r->elevator);
+      if (e != p->e) {
+        return fail(c, n, "Person %s getting off the wrong elevator", who(c, r, name));
+      }
+      if (e->floor != p->to) {
+        return fail(c, n, "Person %s getting off an elevator not on the right floor", who(c, r, name));
+      }
+      if (e->door != 1) {
+        return fail(c, n, "Person %s getting off an elevator whose door isn't open.", who(c, r, name));
+      }
+      if (e->state != 'R') {
+        return fail(c, n, "Person %s getting off an elevator who is not at rest.", who(c, r, name));
+      }
+      p->state = 'F';
+      break;
+
+    case TR_DONE:
+      if (p->state != 'F') {
+        return fail(c, n, "Person %s done before getting off the elevator", who(c, r, name));
+      }
+      jrb_delete_node(tmp);
+      free(p);
+      break;
+  }
+  return CHECK_OK;
+}
+
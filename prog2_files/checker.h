@@ -0,0 +1,40 @@
+/* checker.h
+   The checks that double-check does, on a stream of Trace_Records: doors
+   are only opened when closed and closed when open, elevators only move
+   with the door closed and from where they are, and people get on and
+   off the right elevator, on the right floor, with the door open and the
+   elevator at rest.
+
+   double-check feeds it records parsed from the output; the simulator
+   feeds it the records it logs (elevator -c), so long runs can be
+   checked as they go, without printing or parsing anything.
+
+   checker_check() returns CHECK_OK, CHECK_OVER at the end of the
+   simulation, or CHECK_ERROR, in which case checker_error() says what
+   went wrong.  name is the person's name for the message, or NULL to
+   make it from the record.  n is the number of the line or record, and
+   where says which ("Line" or "Record").
+ */
+
+#ifndef _CHECKER_H_
+#define _CHECKER_H_
+
+#include "trace.h"
+
+#define CHECK_OK     0
+#define CHECK_OVER   1
+#define CHECK_ERROR -1
+
+/* A person line that double-check can't otherwise place.  As in the old
+   double-check, it is only checked for the person existing. */
+
+#define CHECK_PERSON TR_NTYPES
+
+typedef struct checker *Checker;
+
+extern Checker new_checker(char *where);
+extern void free_checker(Checker c);
+extern int checker_check(Checker c, Trace_Record *r, char *name, long long n);
+extern char *checker_error(Checker c);
+
+#endif
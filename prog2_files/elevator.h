@@ -8,8 +8,30 @@
 
 /* Main elevator struct */
 
+#include <stdio.h>
 #include <pthread.h>
 #include "dllist.h"
+#include "finesleep.h"
+#include "rng.h"
+#include "traffic.h"
+#include "lockprof.h"
+
+/* Mutexes and condition variable waits go through the lock profiler
+   (lockprof.h), which does nothing else unless it's turned on (-k). */
+
+#define pthread_mutex_lock(m) lockprof_lock(m)
+#define pthread_mutex_unlock(m) lockprof_unlock(m)
+#define finesleep_cond_wait(fs, c, m) lockprof_cond_wait(fs, c, m)
+#define finesleep_cond_timedwait(fs, c, m, t) lockprof_cond_timedwait(fs, c, m, t)
+
+/* Random number streams, seeded from the command line (see rng.h).  The
+   skeleton draws from the first three; ES_RNG_YOURS is for you. */
+
+#define ES_RNG_ARRIVALS 0     /* Interarrival times */
+#define ES_RNG_NAMES    1
+#define ES_RNG_FLOORS   2     /* Where people come from and go to */
+#define ES_RNG_YOURS    3
+#define ES_NRNG         4
 
 typedef struct {
   int nfloors; 
@@ -20,6 +42,9 @@ typedef struct {
   int npeople_started;        /* Stats. */
   int npeople_finished;
   pthread_mutex_t *lock;
+  void *fs;                   /* The clock.  Block with finesleep_cond_wait(fs, ...) -- see finesleep.h */
+  Rng rng[ES_NRNG];           /* Random number streams */
+  void *sim;                  /* The skeleton's own state -- don't touch */
   void *v;                    /* This is what you get to define */
 } Elevator_Simulation;
 
@@ -37,10 +62,14 @@ typedef struct {
 
 typedef struct {
   char *fname;           /* Person's first name */
-  char *lname;           /* Person's last name */
+  char *lname;           /* Person's last name.  It's printed as lname(id), to be unique */
+  int id;                /* Person's number */
+  int fnum;              /* Indices of the names in FNAMES and LNAMES (names.h) */
+  int lnum;
   int from;              /* Starting floor */
   int to;                /* Ending floor */
   double arrival_time;   /* When the person will arrive at "from" */
+  double board_time;     /* When the person got on (set by get_on_elevator()) */
   Elevator *e;           /* The person's elevator */
   Dllist ptr;            /* Pointer to the person's entry on the elevator's dllist */
   pthread_mutex_t *lock;    
@@ -71,6 +100,46 @@ extern void get_off_elevator(Person *p);              /* Called when a person ge
 
 extern void *person(void *arg);                  /* The person thread */
 
+/* One simulation's parameters and results, for running simulations from
+   your own code rather than from the command line.  Your procedures
+   below must keep their state in the structs (the v fields), not in
+   globals, for simulations to run side by side. */
+
+#define ER_POOL     1   /* Run people on a pool of worker threads (-p) */
+#define ER_BINARY   2   /* Write binary trace records (-b) */
+#define ER_LATENESS 4   /* Print the clock's oversleep on stderr at the end (-l) */
+#define ER_LATENCY  8   /* Print the wait and ride time distributions on stderr at the end (-w) */
+#define ER_CHECK   16   /* Check the events as they are logged, as double-check does (-c) */
+#define ER_SUMMARY 32   /* Print a summary of the counts and latencies on stdout at the end (-q) */
+
+typedef struct {
+  int nfloors;
+  int nelevators;
+  double interarrival_time;
+  double door_time;
+  double floor_to_floor_time;
+  double duration;
+  double drain;          /* If > 0, arrivals stop at duration, and the simulation goes on
+                            for up to this long, until everyone in the building is done (-d) */
+  long seed;
+  char *replay;          /* If not NULL, a file of "arrival_time from to" lines to play back
+                            instead of random arrivals (-r) */
+  Traffic *traffic;      /* Where people go and how bursty they are (-t, -f and -u).
+                            NULL for the original model. */
+  double speed;          /* 0 for virtual time, else real time sped up by this (-s) */
+  int flags;
+  FILE *out;             /* Where the output goes.  NULL for none. */
+  int npeople_started;   /* Results */
+  int npeople_finished;
+  double wait_p50;       /* Seconds from arrival to boarding, of those who boarded */
+  double wait_p99;
+  double ride_p50;       /* Seconds from boarding to getting off, of those who got off */
+  double ride_p99;
+} Elevator_Run;
+
+extern void run_simulation(Elevator_Run *r);                          /* Runs it in this thread */
+extern void run_simulations(Elevator_Run *runs, int n, int nthreads);  /* nthreads at a time */
+
 /* ------------------------------------------------------------------ */
 /* Procedures that you must define: */
 
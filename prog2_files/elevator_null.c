@@ -12,11 +12,10 @@
 #include "dllist.h"
 #include <stdlib.h>
 //Set up lists
-Dllist global_list; //waiting_list
 
 void initialize_simulation(Elevator_Simulation *es)
 {
-  global_list = new_dllist();
+  Dllist global_list = new_dllist();
   es->v = global_list;
   return;
 }
@@ -45,13 +44,13 @@ void wait_for_elevator(Person *p)
   //lock all elevators
   pthread_mutex_lock(p->es->lock);
   //add person to global list
-  global_list = (Dllist) p->es->v;
+  Dllist global_list = (Dllist) p->es->v;
   dll_append(global_list, new_jval_v((void *) p));
   pthread_mutex_unlock(p->es->lock);
 
   //blocking the person's condition variable
   pthread_mutex_lock(p->lock);
-  pthread_cond_wait(p->cond, p->lock);
+  finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -67,9 +66,9 @@ void wait_to_get_off_elevator(Person *p)
   //unblock elevator by signaling to let person off elevator
   pthread_mutex_lock(p->lock);
   //wakes up elevator to let person off.
-  pthread_cond_signal(p->e->cond);
+  finesleep_cond_signal(p->es->fs, p->e->cond);
   //block person person until the elevator is ready to let person off.
-  pthread_cond_wait(p->cond, p->lock);
+  finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -82,7 +81,7 @@ perform any final activties on the person
 void person_done(Person *p)
 {
   pthread_mutex_lock(p->lock);
-  pthread_cond_signal(p->e->cond);
+  finesleep_cond_signal(p->es->fs, p->e->cond);
   pthread_mutex_unlock(p->lock); 
   return;
 }
@@ -111,7 +110,7 @@ Dllist check_for_people_to_load(Elevator *e)
   Dllist load_list = new_dllist();
   pthread_mutex_unlock(e->es->lock);
   Dllist item;
-  global_list = (Dllist) e->es->v;
+  Dllist global_list = (Dllist) e->es->v;
   dll_traverse(item, global_list){
     Person *p = (Person*) jval_v(dll_val(item));
     //printf("\t Should I get %s going from %d to %d?", p->fname, p->from, p->to);
@@ -193,12 +192,12 @@ void *elevator(void *arg)
       //wait for the person to get off.
       //block the elevator while signal the person to wake up to get off the elevator.
       pthread_mutex_lock(e->lock);
-      pthread_cond_signal(p->cond);
+      finesleep_cond_signal(e->es->fs, p->cond);
       // pthread_mutex_unlock(e->lock);
 
       //block the elevator so that elevator won't perform any action until person gets off.
       // pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
+      finesleep_cond_wait(e->es->fs, e->cond, e->lock);
       pthread_mutex_unlock(e->lock);
     }
    
@@ -218,16 +217,16 @@ void *elevator(void *arg)
       //wake person up to enter elevator
       pthread_mutex_lock(e->lock);
       //wakes up the person
-      pthread_cond_signal(p->cond);
+      finesleep_cond_signal(e->es->fs, p->cond);
       // pthread_mutex_unlock(e->lock);
 
       //blocks elevator condition until person wakes it up to get in.
       // pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
+      finesleep_cond_wait(e->es->fs, e->cond, e->lock);
       pthread_mutex_unlock(e->lock);
     }
     move(e); 
   }
-  free_dlliist(global_list);
+  free_dlliist((Dllist) e->es->v);
   return NULL;
 }
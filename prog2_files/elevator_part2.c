@@ -11,13 +11,27 @@
 #include "elevator.h"
 #include "dllist.h"
 #include <stdlib.h>
-//Set up lists
-Dllist global_list; //waiting_list
+//Hall calls: the people waiting on each floor, one list for each direction,
+//so an elevator can take everyone going its way in one step.  Protected by
+//es->lock.
+
+typedef struct {
+  Dllist *up;    //up[f]: waiting on floor f to go up
+  Dllist *down;
+} Halls;
 
 void initialize_simulation(Elevator_Simulation *es)
 {
-  global_list = new_dllist();
-  es->v = global_list;
+  Halls *h = malloc(sizeof(Halls));
+  int f;
+
+  h->up = malloc((es->nfloors+1) * sizeof(Dllist));
+  h->down = malloc((es->nfloors+1) * sizeof(Dllist));
+  for (f = 1; f <= es->nfloors; f++) {
+    h->up[f] = new_dllist();
+    h->down[f] = new_dllist();
+  }
+  es->v = h;
   return;
 }
 
@@ -44,14 +58,15 @@ void wait_for_elevator(Person *p)
 {
   //lock all elevators
   pthread_mutex_lock(p->es->lock);
-  //add person to global list
-  global_list = (Dllist) p->es->v;
-  dll_append(global_list, new_jval_v((void *) p));
+  //add person to the hall call for their floor and direction
+  Halls *h = (Halls *) p->es->v;
+  Dllist *calls = (p->to > p->from) ? h->up : h->down;
+  dll_append(calls[p->from], new_jval_v((void *) p));
   pthread_mutex_unlock(p->es->lock);
 
   //blocking the person's condition variable
   pthread_mutex_lock(p->lock);
-  pthread_cond_wait(p->cond, p->lock);
+  finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -67,9 +82,9 @@ void wait_to_get_off_elevator(Person *p)
   //unblock elevator by signaling to let person off elevator
   pthread_mutex_lock(p->lock);
   //wakes up elevator to let person off.
-  pthread_cond_signal(p->e->cond);
+  finesleep_cond_signal(p->es->fs, p->e->cond);
   //block person person until the elevator is ready to let person off.
-  pthread_cond_wait(p->cond, p->lock);
+  finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -82,7 +97,7 @@ perform any final activties on the person
 void person_done(Person *p)
 {
   pthread_mutex_lock(p->lock);
-  pthread_cond_signal(p->e->cond);
+  finesleep_cond_signal(p->es->fs, p->e->cond);
   pthread_mutex_unlock(p->lock); 
   return;
 }
@@ -104,29 +119,15 @@ Dllist check_for_people_to_unload(Elevator *e)
   return unload_list;
 }
 
+//Takes everyone waiting here to go the elevator's way, by swapping in an
+//empty list, so it doesn't matter how many people are waiting.
 Dllist check_for_people_to_load(Elevator *e)
 { 
-  Dllist load_list = new_dllist();
-  pthread_mutex_unlock(e->es->lock);
-  Dllist item;
-  global_list = (Dllist) e->es->v;
-  dll_traverse(item, global_list){
-    Person *p = (Person*) jval_v(dll_val(item));
-    //printf("\t Should I get %s going from %d to %d?", p->fname, p->from, p->to);
-    if(p->from == e->onfloor)
-    {
-      if((p->to > e->onfloor && *(int*)(e->v) == 1) || (p->to < e->onfloor && e->v == 0))
-      {
-        //printf("yes!\n");
-        //set item to point next item on list.
-        item = dll_prev(item);
-        //delete the node that that was once where the item was
-        dll_delete_node(dll_next(item));
-        //append item to load_list
-        dll_append(load_list, new_jval_v((void *)p));
-      } 
-    }
-  }
+  pthread_mutex_lock(e->es->lock);
+  Halls *h = (Halls *) e->es->v;
+  Dllist *calls = (*(int*)(e->v) == 1) ? h->up : h->down;
+  Dllist load_list = calls[e->onfloor];
+  calls[e->onfloor] = new_dllist();
   pthread_mutex_unlock(e->es->lock);
   return  load_list;
 }
@@ -190,14 +191,15 @@ void *elevator(void *arg)
       //wait for the person to get off.
       //block the elevator while signal the person to wake up to get off the elevator.
       pthread_mutex_lock(e->lock);
-      pthread_cond_signal(p->cond);
+      finesleep_cond_signal(e->es->fs, p->cond);
       // pthread_mutex_unlock(e->lock);
 
       //block the elevator so that elevator won't perform any action until person gets off.
       // pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
+      finesleep_cond_wait(e->es->fs, e->cond, e->lock);
       pthread_mutex_unlock(e->lock);
     }
+    free_dllist(unload_list);
    
     Dllist load_list = check_for_people_to_load(e);
     //load people
@@ -217,14 +219,15 @@ void *elevator(void *arg)
       //wake person up to enter elevator
       pthread_mutex_lock(e->lock);
       //wakes up the person
-      pthread_cond_signal(p->cond);
+      finesleep_cond_signal(e->es->fs, p->cond);
       // pthread_mutex_unlock(e->lock);
 
       //blocks elevator condition until person wakes it up to get in.
       // pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
+      finesleep_cond_wait(e->es->fs, e->cond, e->lock);
       pthread_mutex_unlock(e->lock);
     }
+    free_dllist(load_list);
     move(e);
   }
   return NULL;
@@ -10,24 +10,47 @@
 #include <pthread.h>
 #include "elevator.h"
 #include "dllist.h"
+#include <stdlib.h>
+/* The waiting people are a dispatch queue: a list, protected by es->lock,
+and a condition variable on which idle elevators block.  wait_for_elevator()
+signals it once per person, so an elevator only wakes up when there is
+someone to take, and idle elevators use no CPU. */
+typedef struct {
+  Dllist people;
+  pthread_cond_t cond;
+} Dispatch;
+
+/* An elevator serves one person at a time.  These say how far the person
+has got, so that no signal is lost if it comes before the wait. */
+typedef struct {
+  int on;    //the person has got on
+  int off;   //the person has got off
+} Ride;
+
 /*set up the global list and a condition
 variable for blocking elevators.*/
-Dllist global_list;
 void initialize_simulation(Elevator_Simulation *es)
 {
-  // es->v = (void *) new_dllist();
-  global_list = new_dllist();
-  es->v = global_list;
+  Dispatch *d = (Dispatch *) malloc(sizeof(Dispatch));
+  d->people = new_dllist();
+  pthread_cond_init(&d->cond, NULL);
+  es->v = (void *) d;
   return;
 }
 
 void initialize_elevator(Elevator *e)
 {
+  Ride *r = (Ride *) malloc(sizeof(Ride));
+  r->on = 0;
+  r->off = 0;
+  e->v = (void *) r;
   return;
 }
 
-void initialize_person(Person *e)
+//p->v is set to non-NULL when the person's elevator is at the destination
+void initialize_person(Person *p)
 {
+  p->v = NULL;
   return;
 }
 
@@ -40,17 +63,17 @@ blocks until an elevator is on the person's floor with its door open
 */
 void wait_for_elevator(Person *p)
 {
-  // printf("calling wait for elevator\n");
-  //lock all elevators
+  Dispatch *d = (Dispatch *) p->es->v;
+
+  //add person to the queue and wake up one idle elevator
   pthread_mutex_lock(p->es->lock);
-  //add person to global list
-  global_list = (Dllist) p->es->v;
-  dll_append(global_list, new_jval_v((void *) p));
+  dll_append(d->people, new_jval_v((void *) p));
+  finesleep_cond_signal(p->es->fs, &d->cond);
   pthread_mutex_unlock(p->es->lock);
 
-  //blocking the person's condition variable
+  //block until an elevator has set the person's e field
   pthread_mutex_lock(p->lock);
-  pthread_cond_wait(p->cond, p->lock);
+  while (p->e == NULL) finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -63,13 +86,17 @@ blocks until elevator has moved to the person's destination floor and opened the
 */
 void wait_to_get_off_elevator(Person *p)
 {
-  // printf("calling wait to get off elevator \n");
-  //unblock elevator by signaling to let person off elevator
+  Ride *r = (Ride *) p->e->v;
+
+  //tell the elevator that the person is on
+  pthread_mutex_lock(p->e->lock);
+  r->on = 1;
+  finesleep_cond_signal(p->es->fs, p->e->cond);
+  pthread_mutex_unlock(p->e->lock);
+
+  //block until the elevator is at the destination with its door open
   pthread_mutex_lock(p->lock);
-  //wakes up elevator to let person off.
-  pthread_cond_signal(p->e->cond);
-  //block person person until the elevator is ready to let person off.
-  pthread_cond_wait(p->cond, p->lock);
+  while (p->v == NULL) finesleep_cond_wait(p->es->fs, p->cond, p->lock);
   pthread_mutex_unlock(p->lock);
   return;
 }
@@ -81,97 +108,75 @@ perform any final activties on the person
 */
 void person_done(Person *p)
 {
-  // printf("Calling person_done\n");
-  //unblock the person's elevator 
-  pthread_mutex_lock(p->lock);
-  pthread_cond_signal(p->e->cond);
-  pthread_mutex_unlock(p->lock); 
+  Ride *r = (Ride *) p->e->v;
+
+  //tell the elevator that the person is off
+  pthread_mutex_lock(p->e->lock);
+  r->off = 1;
+  finesleep_cond_signal(p->es->fs, p->e->cond);
+  pthread_mutex_unlock(p->e->lock);
   return;
 }
 
-/* Each elevator is a while loop. Check the global list and if it’s empty,
-block on the condition variable for blocking elevators. When the elevator gets a person to service, it
-moves to the appropriate floor and opens its door. It puts itself into the person’s e field, then signals the
-person and blocks until the person wakes it up. When it wakes up, it goes to the person’s destination
-floor, opens its door, signals the person and blocks. When the person wakes it up, it closes its door
+/* Each elevator is a while loop. Take the first person off the queue,
+blocking on the queue's condition variable while it's empty. The elevator
+moves to the person's floor and opens its door. It puts itself into the person’s e field, then signals the
+person and blocks until the person is on. Then it goes to the person’s destination
+floor, opens its door, signals the person and blocks until the person is off,
 and re-executes its while loop.*/
 void *elevator(void *arg)
 {
-  // printf("calling elevator \n");
   Elevator *e = (Elevator *)arg;
-  Person *p = NULL;
+  Dispatch *d = (Dispatch *) e->es->v;
+  Ride *r = (Ride *) e->v;
+  Person *p;
+
   while(1)
   {
-    //if the there is people waiting on the global list queue
+    //block until someone is waiting, then take the first person
     pthread_mutex_lock(e->es->lock);
-    global_list = (Dllist) e->es->v;
-    if(!dll_empty(global_list)){
-      //take the first person of global_list
-      Dllist first_person = dll_first(global_list);
-      p = (Person*) jval_v(dll_val(first_person));
-      // //remove person from global list
-      dll_delete_node(first_person);
-    }
+    while (dll_empty(d->people)) finesleep_cond_wait(e->es->fs, &d->cond, e->es->lock);
+    p = (Person *) jval_v(dll_val(dll_first(d->people)));
+    dll_delete_node(dll_first(d->people));
     pthread_mutex_unlock(e->es->lock);
 
-    if(p == NULL)
+    //if the elevator is not on the person's current floor
+    //move to that floor
+    if(p->from != e->onfloor)
     {
-      continue;
-    }
-      // printf("person floor %s %d\n", p->fname, p->from);
-      // printf("elevator’s current floor %d\n", e->onfloor);
-
-      //if the elevator is not on the person's current floor
-      //move to that floor
-      if(p->from != e->onfloor)
-      {
-        //if the door is open close it
-        if(e->door_open)
-        {
-          // printf("person's in elevator %s\n", p->fname);
-          // printf("line 139, closing door not on the floor person is from\n");
-          close_door(e);
-        }
-        // printf("elevator is on %s floor",p->fname);
-        //move to the person's floor
-        move_to_floor(e, p->from);
-      }
-      
-      //elevator door is closed then elevator must be on the same floor
-      //open the door and add the elevator to the person's e field
-      if(!e->door_open)
-      {
-        open_door(e);
-             
-      }
-      p->e = e; // add elevator to person's e field  
-      // printf("elevator is on %s ",e->door_open);
-      //This point the elevator should wake up the person to let them in the elevator
-      pthread_mutex_lock(e->lock);
-      //wakes up the person
-      pthread_cond_signal(p->cond);
-      pthread_mutex_unlock(e->lock);
-
-      //blocks elevator condition until person wakes it up to get in.
-      pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
-      pthread_mutex_unlock(e->lock);
-
-      // printf("elevator is on %s floor",p->fname);
-      //close the door move the elevator to person's destination, and open the door
-      close_door(e);
-      move_to_floor(e, p->to);
-      open_door(e);
-
-      //block the elevator while signal the person to wake up to get off the elevator.
-      pthread_mutex_lock(e->lock);
-      pthread_cond_signal(p->cond);
-      pthread_mutex_unlock(e->lock);
-
-      //block the elevator so that elevator won't perform any action until person gets off.
-      pthread_mutex_lock(e->lock);
-      pthread_cond_wait(e->cond, e->lock);
-      pthread_mutex_unlock(e->lock);
+      if(e->door_open) close_door(e);
+      move_to_floor(e, p->from);
     }
+    if(!e->door_open) open_door(e);
+
+    //add elevator to person's e field and wake the person up
+    pthread_mutex_lock(p->lock);
+    p->e = e;
+    finesleep_cond_signal(e->es->fs, p->cond);
+    pthread_mutex_unlock(p->lock);
+
+    //block until the person is on
+    pthread_mutex_lock(e->lock);
+    while (!r->on) finesleep_cond_wait(e->es->fs, e->cond, e->lock);
+    r->on = 0;
+    pthread_mutex_unlock(e->lock);
+
+    //close the door move the elevator to person's destination, and open the door
+    close_door(e);
+    move_to_floor(e, p->to);
+    open_door(e);
+
+    //wake the person up to get off
+    pthread_mutex_lock(p->lock);
+    p->v = (void *) e;
+    finesleep_cond_signal(e->es->fs, p->cond);
+    pthread_mutex_unlock(p->lock);
+
+    //block until the person is off
+    pthread_mutex_lock(e->lock);
+    while (!r->off) finesleep_cond_wait(e->es->fs, e->cond, e->lock);
+    r->off = 0;
+    pthread_mutex_unlock(e->lock);
+  }
   return NULL;
 }
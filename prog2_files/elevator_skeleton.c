@@ -9,47 +9,212 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
 #include "names.h"
 #include "elevator.h"
 #include "finesleep.h"
+#include "evlog.h"
+#include "trace.h"
+#include "histogram.h"
+#include "checker.h"
 #include "dllist.h"
+#include "fields.h"
 
 #define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
 
-void *FINESLEEPER;
+/* People come from a per-simulation freelist.  Each Person is carved out
+   of a chunk together with its mutex and condition variable, in a
+   cache-line aligned block, and goes back on the list when it is
+   done.  The mutex and condition variable stay initialized in between, so
+   once the building is full, an arrival does no mallocs at all. */
+
+#define PERSON_CHUNK 256
+
+typedef struct person_block {
+  Person p;                           /* First, so a Person * is a Person_Block * */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct person_block *next;
+} __attribute__((aligned(64))) Person_Block;
+
+typedef struct {
+  pthread_mutex_t lock;
+  Person_Block *free;
+  Dllist chunks;
+} Person_Slab;
+
+/* With -p, people don't get a thread each.  They are queued for a pool of
+   worker threads with small stacks, which run them one after another.  A
+   worker is only created when all of the existing ones are busy, so the
+   pool grows to the peak number of people in the building, and after
+   that arrivals cost no thread creation at all.  Idle workers block in
+   finesleep_cond_wait(), so they don't hold up the clock. */
+
+#define POOL_STACK (128 * 1024)
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Dllist people;              /* People waiting for a worker */
+  int nidle;                  /* Idle workers that haven't been signalled yet */
+  int nworkers;
+  pthread_attr_t attr;
+} Person_Pool;
+
+typedef struct {
+  double time;
+  int from;
+  int to;
+} Arrival;
+
+/* Event counters are bumped with atomic adds, each on its own cache
+   line, so that counting costs next to nothing even with no output. */
+
+typedef struct {
+  long long n;
+} __attribute__((aligned(64))) Counter;
+
+/* Everything the skeleton keeps for one simulation.  es->sim points here.
+   There are no globals, so that simulations can run side by side. */
+
+typedef struct {
+  Elevator_Run *run;
+  Elevator_Simulation es;
+  Evlog log;                  /* NULL if there's no output and no checking */
+  Checker checker;            /* With -c */
+  long long nrecords;         /* Checked so far -- only the log's writer touches this */
+  Counter counts[TR_NTYPES];  /* Of each type of event, logged or not */
+  Person_Slab *slab;
+  Person_Pool *pool;          /* NULL if each person gets a thread */
+  Dllist elevators;
+  Histogram wait;             /* Arrival to boarding, in ns */
+  Histogram ride;             /* Boarding to getting off */
+  int draining;               /* Set when arrivals stop (see drain()).  Under es->lock */
+  pthread_cond_t drained;     /* Signalled when the last person is done */
+  Arrival *arrivals;          /* With a replay file, the arrivals (see replay_gen()) */
+  int narrivals;
+} Sim;
+
+#define SIM(es) ((Sim *) (es)->sim)
+
+/* Output goes through an asynchronous log (evlog.h), so that the
+   primitives don't serialize on es->lock and a write() per line.  Each
+   line is a Trace_Record (trace.h), which the log's writer thread prints
+   as text, or with -b, writes as is.
+
+   With -c, the writer also runs double-check's checks (checker.h) on the
+   records, in the order in which they were logged.  That order is safe
+   to check: each elevator's events are logged by its own thread or under
+   its lock, and people get on and off under the elevator's lock too.  A
+   failed check ends the process, once the output so far is flushed. */
+
+static void check_record(Sim *sim, FILE *f, Trace_Record *r)
+{
+  if (sim->checker == NULL) return;
+  sim->nrecords++;
+  if (checker_check(sim->checker, r, NULL, sim->nrecords) != CHECK_ERROR) return;
+  if (f != NULL) fflush(f);
+  fprintf(stderr, "Check failed at time %.3lf: %s\n", r->time / 1000000000.0, checker_error(sim->checker));
+  exit(1);
+}
+
+static void write_text(void *sim, FILE *f, void *r)
+{
+  trace_print(f, (Trace_Record *) r);
+  check_record((Sim *) sim, f, (Trace_Record *) r);
+}
+
+static void write_binary(void *sim, FILE *f, void *r)
+{
+  fwrite(r, sizeof(Trace_Record), 1, f);
+  check_record((Sim *) sim, f, (Trace_Record *) r);
+}
+
+static void write_nothing(void *sim, FILE *f, void *r)
+{
+  check_record((Sim *) sim, f, (Trace_Record *) r);
+}
+
+static void log_event(Elevator_Simulation *es, int type, long long time, int elevator, int floor, int to)
+{
+  Trace_Record *r;
+
+  __atomic_fetch_add(&SIM(es)->counts[type].n, 1, __ATOMIC_RELAXED);
+  if (SIM(es)->log == NULL) return;
+  r = (Trace_Record *) evlog_claim(SIM(es)->log);
+  if (r == NULL) return;                          /* The log is closed */
+  r->time = time;
+  r->type = type;
+  r->elevator = elevator;
+  r->person = 0;
+  r->floor = floor;
+  r->to = to;
+  r->fname = 0;
+  r->lname = 0;
+  evlog_commit(SIM(es)->log, r);
+}
+
+static void log_person(int type, Person *p, int elevator, int floor, int to)
+{
+  Trace_Record *r;
+
+  __atomic_fetch_add(&SIM(p->es)->counts[type].n, 1, __ATOMIC_RELAXED);
+  if (SIM(p->es)->log == NULL) return;
+  r = (Trace_Record *) evlog_claim(SIM(p->es)->log);
+  if (r == NULL) return;
+  r->time = finesleep_time_ns(p->es->fs);
+  r->type = type;
+  r->elevator = elevator;
+  r->person = p->id;
+  r->floor = floor;
+  r->to = to;
+  r->fname = p->fnum;
+  r->lname = p->lnum;
+  evlog_commit(SIM(p->es)->log, r);
+}
+
+/* Errors go straight to stderr, but the log is drained first, so that
+   the output has everything up to the error.  They end the process. */
+
+static void die(Elevator_Simulation *es)
+{
+  if (SIM(es)->log != NULL) evlog_close(SIM(es)->log);
+  exit(1);
+}
+
+/* The primitives below take the time once, when the action starts, and
+   sleep until start + duration, so delays in getting the locks don't add
+   up over a long run. */
 
 void move_to_floor(Elevator *e, int floor)
 {
   double diff;
+  long long start;
   pthread_mutex_lock(e->lock);
   if (e->door_open) {
     fprintf(stderr, "Error at time %.3lf: Move to floor on elevator %02d with the door open.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
   if (e->moving) {
     fprintf(stderr, "Error at time %.3lf: Move to floor on elevator %02d that is already moving.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
   diff = floor - e->onfloor;
   if (diff < 0) diff = -diff;
   diff *= e->es->floor_to_floor_time;
   e->moving = 1;
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d moving from floor %02d to floor %02d.\n", 
-       finesleep_time(FINESLEEPER), e->id, e->onfloor, floor);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
+  start = finesleep_time_ns(e->es->fs);
+  log_event(e->es, TR_MOVING, start, e->id, e->onfloor, floor);
   pthread_mutex_unlock(e->lock);
-  finesleep_sleep(FINESLEEPER, diff);
+  finesleep_sleep_until_ns(e->es->fs, start + (long long) (diff * 1000000000.0 + 0.5));
   pthread_mutex_lock(e->lock);
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d arrives at floor %02d.\n", 
-       finesleep_time(FINESLEEPER), e->id, floor);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
+  log_event(e->es, TR_ARRIVES, finesleep_time_ns(e->es->fs), e->id, floor, 0);
   e->moving = 0;
   e->onfloor = floor;
   pthread_mutex_unlock(e->lock);
@@ -57,52 +222,46 @@ void move_to_floor(Elevator *e, int floor)
 
 void open_door(Elevator *e)
 {
+  long long start;
+
   if (e->door_open) {
     fprintf(stderr, "Error at time %.3lf: Open door called on elevator %02d with the door already open.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
   if (e->moving) {
     fprintf(stderr, "Error at time %.3lf: Open door called on elevator %02d with the elevator moving.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d opening its door.\n", finesleep_time(FINESLEEPER), e->id);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
-  finesleep_sleep(FINESLEEPER, e->es->door_time);
+  start = finesleep_time_ns(e->es->fs);
+  log_event(e->es, TR_OPENING, start, e->id, 0, 0);
+  finesleep_sleep_until_ns(e->es->fs, start + (long long) (e->es->door_time * 1000000000.0 + 0.5));
   pthread_mutex_lock(e->lock);
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d door is open.\n", finesleep_time(FINESLEEPER), e->id);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
+  log_event(e->es, TR_OPEN, finesleep_time_ns(e->es->fs), e->id, 0, 0);
   e->door_open = 1;
   pthread_mutex_unlock(e->lock);
 }
 
 void close_door(Elevator *e)
 {
+  long long start;
+
   if (!e->door_open) {
     fprintf(stderr, "Error at time %.3lf: Close door called on elevator %02d with the door already open.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
   if (e->moving) {
     fprintf(stderr, "Error at time %.3lf: Close door called on elevator %02d with the elevator moving.\n",
-            finesleep_time(FINESLEEPER), e->id);
-    exit(1);
+            finesleep_time(e->es->fs), e->id);
+    die(e->es);
   }
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d closing its door.\n", finesleep_time(FINESLEEPER), e->id);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
-  finesleep_sleep(FINESLEEPER, e->es->door_time);
+  start = finesleep_time_ns(e->es->fs);
+  log_event(e->es, TR_CLOSING, start, e->id, 0, 0);
+  finesleep_sleep_until_ns(e->es->fs, start + (long long) (e->es->door_time * 1000000000.0 + 0.5));
   pthread_mutex_lock(e->lock);
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: Elevator %02d door is closed.\n", finesleep_time(FINESLEEPER), e->id);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
+  log_event(e->es, TR_CLOSED, finesleep_time_ns(e->es->fs), e->id, 0, 0);
   e->door_open = 0;
   pthread_mutex_unlock(e->lock);
 }
@@ -113,34 +272,32 @@ void get_on_elevator(Person *p)
 
   e = p->e;
   if (e == NULL) {
-    fprintf(stderr, "Error at time %.3lf: %s %s called get_on_elevator with a NULL elevator.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) called get_on_elevator with a NULL elevator.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id);
+    die(p->es);
   }
     
   pthread_mutex_lock(e->lock);
   if (!e->door_open) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_on_elevator(%02d) - door closed.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_on_elevator(%02d) - door closed.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   if (e->moving) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_on_elevator(%02d) - elevator moving.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_on_elevator(%02d) - elevator moving.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   if (e->onfloor != p->from) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_on_elevator(%02d) - Elevator on wrong floor.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_on_elevator(%02d) - Elevator on wrong floor.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   dll_append(e->people, new_jval_v((void *) p));
   p->ptr = e->people->blink;
-  pthread_mutex_lock(e->es->lock);
-  printf("%8.3lf: %s %s gets on elevator %02d on floor %02d.\n", finesleep_time(FINESLEEPER), 
-          p->fname, p->lname, e->id, e->onfloor);
-  fflush(stdout);
-  pthread_mutex_unlock(e->es->lock);
+  p->board_time = finesleep_time(p->es->fs);
+  hist_add(SIM(p->es)->wait, (long long) ((p->board_time - p->arrival_time) * 1000000000.0));
+  log_person(TR_GETS_ON, p, e->id, e->onfloor, 0);
   pthread_mutex_unlock(e->lock);
 }
 
@@ -150,49 +307,113 @@ void get_off_elevator(Person *p)
 
   e = p->e;
   if (e == NULL) {
-    fprintf(stderr, "Error at time %.3lf: %s %s called get_off_elevator with a NULL elevator.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) called get_off_elevator with a NULL elevator.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id);
+    die(p->es);
   }
     
   pthread_mutex_lock(e->lock);
   if (!e->door_open) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_off_elevator(%02d) - door closed.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_off_elevator(%02d) - door closed.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   if (e->moving) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_off_elevator(%02d) - elevator moving.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_off_elevator(%02d) - elevator moving.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   if (e->onfloor != p->to) {
-    fprintf(stderr, "Error at time %.3lf: %s %s get_off_elevator(%02d) - Elevator on wrong floor.\n",
-            finesleep_time(FINESLEEPER), p->fname, p->lname, e->id);
-    exit(1);
+    fprintf(stderr, "Error at time %.3lf: %s %s(%d) get_off_elevator(%02d) - Elevator on wrong floor.\n",
+            finesleep_time(p->es->fs), p->fname, p->lname, p->id, e->id);
+    die(p->es);
   }
   dll_delete_node(p->ptr);
   p->ptr = NULL;
-  pthread_mutex_lock(p->es->lock);
-  printf("%8.3lf: %s %s gets off elevator %02d on floor %02d.\n", finesleep_time(FINESLEEPER), 
-          p->fname, p->lname, e->id, e->onfloor);
-  fflush(stdout);
-  pthread_mutex_unlock(p->es->lock);
+  hist_add(SIM(p->es)->ride, (long long) ((finesleep_time(p->es->fs) - p->board_time) * 1000000000.0));
+  log_person(TR_GETS_OFF, p, e->id, e->onfloor, 0);
   pthread_mutex_unlock(e->lock);
 }
 
-void *person(void *arg)
+Person_Slab *new_person_slab()
 {
-  Person *p;
+  Person_Slab *ps;
 
-  p = (Person *) arg;
+  ps = talloc(Person_Slab, 1);
+  pthread_mutex_init(&ps->lock, NULL);
+  lockprof_register(&ps->lock, "slab");
+  ps->free = NULL;
+  ps->chunks = new_dllist();
+  return ps;
+}
 
-  pthread_mutex_lock(p->es->lock);
-  p->es->npeople_started++;
-  printf("%8.3lf: %s %s arrives at floor %02d wanting to go to floor %02d.\n", finesleep_time(FINESLEEPER), 
-         p->fname, p->lname, p->from, p->to);
-  fflush(stdout);
-  pthread_mutex_unlock(p->es->lock);
+void free_person_slab(Person_Slab *ps)
+{
+  Dllist ptr;
+  Person_Block *b;
+  int i;
+
+  dll_traverse(ptr, ps->chunks) {
+    b = (Person_Block *) ptr->val.v;
+    for (i = 0; i < PERSON_CHUNK; i++) lockprof_forget(&b[i].lock);
+    free(b);
+  }
+  lockprof_forget(&ps->lock);
+  free_dllist(ps->chunks);
+  pthread_mutex_destroy(&ps->lock);
+  free(ps);
+}
+
+Person *new_person(Elevator_Simulation *es)
+{
+  Person_Slab *ps;
+  Person_Block *b;
+  int i;
+
+  ps = SIM(es)->slab;
+  pthread_mutex_lock(&ps->lock);
+  if (ps->free == NULL) {
+    if (posix_memalign((void **) &b, 64, PERSON_CHUNK * sizeof(Person_Block)) != 0) {
+      fprintf(stderr, "Out of memory for people\n");
+      die(es);
+    }
+    for (i = 0; i < PERSON_CHUNK; i++) {
+      pthread_mutex_init(&b[i].lock, NULL);
+      lockprof_register(&b[i].lock, "p->lock");
+      pthread_cond_init(&b[i].cond, NULL);
+      b[i].next = (i+1 < PERSON_CHUNK) ? &b[i+1] : NULL;
+    }
+    dll_append(ps->chunks, new_jval_v((void *) b));
+    ps->free = b;
+  }
+  b = ps->free;
+  ps->free = b->next;
+  pthread_mutex_unlock(&ps->lock);
+
+  b->p.lock = &b->lock;
+  b->p.cond = &b->cond;
+  return &b->p;
+}
+
+void free_person(Person *p)
+{
+  Person_Slab *ps;
+  Person_Block *b;
+
+  ps = SIM(p->es)->slab;
+  b = (Person_Block *) p;
+  pthread_mutex_lock(&ps->lock);
+  b->next = ps->free;
+  ps->free = b;
+  pthread_mutex_unlock(&ps->lock);
+}
+
+static void run_person(Person *p)
+{
+  Elevator_Simulation *es;
+
+  es = p->es;
+  log_person(TR_PERSON_ARRIVES, p, 0, p->from, p->to);
           
   wait_for_elevator(p);
   get_on_elevator(p);
@@ -200,124 +421,346 @@ void *person(void *arg)
   get_off_elevator(p);
   person_done(p);
 
-  pthread_mutex_lock(p->es->lock);
-  printf("%8.3lf: %s %s is done.\n", finesleep_time(FINESLEEPER), p->fname, p->lname);
-  fflush(stdout);
-  p->es->npeople_finished++;
-  pthread_mutex_unlock(p->es->lock);
-
-  pthread_mutex_destroy(p->lock);
-  free(p->lock);
-  pthread_cond_destroy(p->cond);
-  free(p->cond);
-  free(p);
+  log_person(TR_DONE, p, 0, 0, 0);
+  free_person(p);
+  pthread_mutex_lock(es->lock);
+  es->npeople_finished++;
+  if (SIM(es)->draining && es->npeople_finished == es->npeople_started) {
+    finesleep_cond_signal(es->fs, &SIM(es)->drained);
+  }
+  pthread_mutex_unlock(es->lock);
+}
+
+void *person(void *arg)
+{
+  Person *p;
+  Elevator_Simulation *es;
+
+  p = (Person *) arg;
+  es = p->es;
+  run_person(p);
+  finesleep_thread_exit(es->fs);
   return NULL;
 }
 
-void *person_gen(void *arg)
+void *person_worker(void *arg)
+{
+  Elevator_Simulation *es;
+  Person_Pool *pp;
+  Person *p;
+
+  es = (Elevator_Simulation *) arg;
+  pp = SIM(es)->pool;
+  while (1) {
+    pthread_mutex_lock(&pp->lock);
+    while (dll_empty(pp->people)) {
+      pp->nidle++;
+      finesleep_cond_wait(es->fs, &pp->cond, &pp->lock);
+    }
+    p = (Person *) jval_v(dll_val(dll_first(pp->people)));
+    dll_delete_node(dll_first(pp->people));
+    pthread_mutex_unlock(&pp->lock);
+    run_person(p);
+  }
+  return NULL;
+}
+
+Person_Pool *new_person_pool()
+{
+  Person_Pool *pp;
+
+  pp = talloc(Person_Pool, 1);
+  pthread_mutex_init(&pp->lock, NULL);
+  lockprof_register(&pp->lock, "pool");
+  pthread_cond_init(&pp->cond, NULL);
+  pp->people = new_dllist();
+  pp->nidle = 0;
+  pp->nworkers = 0;
+  pthread_attr_init(&pp->attr);
+  pthread_attr_setstacksize(&pp->attr, POOL_STACK);
+  pthread_attr_setdetachstate(&pp->attr, PTHREAD_CREATE_DETACHED);
+  return pp;
+}
+
+void free_person_pool(Person_Pool *pp)
+{
+  free_dllist(pp->people);
+  pthread_attr_destroy(&pp->attr);
+  pthread_cond_destroy(&pp->cond);
+  lockprof_forget(&pp->lock);
+  pthread_mutex_destroy(&pp->lock);
+  free(pp);
+}
+
+void pool_submit(Person *p)
 {
   Elevator_Simulation *es;
+  Person_Pool *pp;
+  pthread_t tid;
+
+  es = p->es;
+  pp = SIM(es)->pool;
+  pthread_mutex_lock(&pp->lock);
+  dll_append(pp->people, new_jval_v((void *) p));
+  if (pp->nidle > 0) {
+    pp->nidle--;
+    finesleep_cond_signal(es->fs, &pp->cond);
+  } else {
+    finesleep_thread_add(es->fs);
+    if (pthread_create(&tid, &pp->attr, person_worker, (void *) es) != 0) {
+      fprintf(stderr, "Pthread create for worker %d failed\n", pp->nworkers);
+      die(es);
+    }
+    pp->nworkers++;
+  }
+  pthread_mutex_unlock(&pp->lock);
+}
+
+/* Gives p a name and sends it into the building. */
+
+static void start_person(Elevator_Simulation *es, Person *p, int id)
+{
   pthread_t tid;
+
+  p->fnum = rng_int(&es->rng[ES_RNG_NAMES], 200);
+  p->fname = FNAMES[p->fnum];
+  p->lnum = rng_int(&es->rng[ES_RNG_NAMES], 200);
+  p->lname = LNAMES[p->lnum];
+  p->id = id;
+  p->arrival_time = finesleep_time(es->fs);
+  p->e = NULL;
+  p->ptr = NULL;
+  p->es = es;
+  initialize_person(p);
+  if (SIM(es)->pool != NULL) {
+    pool_submit(p);
+    return;
+  }
+  finesleep_thread_add(es->fs);
+  if (pthread_create(&tid, NULL, person, (void *) p) != 0) {
+    fprintf(stderr, "Pthread create for person %d failed\n", id);
+    die(es);
+  }
+  pthread_detach(tid);
+}
+
+/* Counts the next person as started, unless the arrivals have stopped.
+   Both happen under es->lock, so drain() can't miss anyone. */
+
+static int admit_person(Elevator_Simulation *es)
+{
+  int admitted;
+
+  pthread_mutex_lock(es->lock);
+  admitted = !SIM(es)->draining;
+  if (admitted) es->npeople_started++;
+  pthread_mutex_unlock(es->lock);
+  return admitted;
+}
+
+/* Arrivals and trips are drawn according to the run's traffic profile
+   (traffic.h). */
+
+void *person_gen(void *arg)
+{
+  Elevator_Simulation *es;
+  Traffic *t, dflt;
+  Traffic_State ts;
   double tosleep;
   Person *p;
-  double perc;
-  char *s;
   int pn;
 
   pn = 0;
   es = (Elevator_Simulation *) arg;
+  t = SIM(es)->run->traffic;
+  if (t == NULL) {
+    traffic_init(&dflt);
+    t = &dflt;
+  }
+  traffic_start(t, &ts, &es->rng[ES_RNG_ARRIVALS]);
   while (1) {
-    tosleep = -1.0 * log(1.0 - drand48()) * es->interarrival_time;
-    finesleep_sleep(FINESLEEPER, tosleep);
-    p = talloc(Person, 1);
-    p->fname = FNAMES[lrand48()%200];   
-    s = LNAMES[lrand48()%200];   
-    p->lname = talloc(char, strlen(s)+20);
-    sprintf(p->lname, "%s(%d)", s, pn);
+    tosleep = traffic_gap(t, &ts, &es->rng[ES_RNG_ARRIVALS], es->interarrival_time);
+    finesleep_sleep(es->fs, tosleep);
+    if (!admit_person(es)) break;
+    p = new_person(es);
+    traffic_trip(t, &es->rng[ES_RNG_FLOORS], es->nfloors, &p->from, &p->to);
+    start_person(es, p, pn);
     pn++;
+  }
+  finesleep_thread_exit(es->fs);
+  return NULL;
+}
 
-    perc = drand48();
-    if (perc < 0.333333) {
-      p->from = 1;
-      p->to = lrand48()%(es->nfloors-1) + 2;
-    } else if (perc < 0.6666667) {
-      p->from = lrand48()%(es->nfloors-1) + 2;
-      p->to = 1;
-    } else {
-      p->from = lrand48()%(es->nfloors) + 1;
-      do {
-        p->to = lrand48()%(es->nfloors) + 1;
-      } while (p->from == p->to);
-    }
+/* Replay: instead of drawing arrivals, person_gen() plays back the rows
+   of a file, each "arrival_time from to", with the time in seconds from
+   the start of the simulation.  Blank lines and lines starting with # are
+   ignored.  Once the rows run out, nobody else arrives. */
 
-    p->arrival_time = finesleep_time(FINESLEEPER);
-    p->e = NULL;
-    p->ptr = NULL;
-    p->lock = talloc(pthread_mutex_t, 1);
-    pthread_mutex_init(p->lock, NULL);
-    p->cond = talloc(pthread_cond_t, 1);
-    pthread_cond_init(p->cond, NULL);
-    p->es = es;
-    initialize_person(p);
-    if (pthread_create(&tid, NULL, person, (void *) p) != 0) {
-      pthread_mutex_lock(es->lock);
-      printf("Pthread create for person %d failed\n", pn);
-      fflush(stdout);
+static void read_arrivals(Sim *sim, char *file)
+{
+  IS is;
+  Arrival *a;
+  int n;
+
+  is = new_inputstruct(file);
+  if (is == NULL) {
+    perror(file);
+    exit(1);
+  }
+  n = 64;
+  sim->arrivals = talloc(Arrival, n);
+  sim->narrivals = 0;
+  while (get_line(is) >= 0) {
+    if (is->NF == 0 || is->fields[0][0] == '#') continue;
+    if (sim->narrivals == n) {
+      n *= 2;
+      sim->arrivals = (Arrival *) realloc(sim->arrivals, n * sizeof(Arrival));
+    }
+    a = &sim->arrivals[sim->narrivals];
+    if (is->NF != 3 || sscanf(is->fields[0], "%lf", &a->time) != 1 ||
+        sscanf(is->fields[1], "%d", &a->from) != 1 || sscanf(is->fields[2], "%d", &a->to) != 1) {
+      fprintf(stderr, "%s line %d: need arrival_time from to\n", file, is->line);
       exit(1);
     }
-    pthread_detach(tid);
+    if (a->time < 0 || (sim->narrivals > 0 && a->time < a[-1].time)) {
+      fprintf(stderr, "%s line %d: arrival times must be >= 0 and in order\n", file, is->line);
+      exit(1);
+    }
+    if (a->from < 1 || a->from > sim->es.nfloors || a->to < 1 || a->to > sim->es.nfloors ||
+        a->from == a->to) {
+      fprintf(stderr, "%s line %d: floors must be different and between 1 and %d\n",
+              file, is->line, sim->es.nfloors);
+      exit(1);
+    }
+    sim->narrivals++;
   }
+  jettison_inputstruct(is);
 }
 
-void usage(char *s)
+void *replay_gen(void *arg)
 {
-  fprintf(stderr, "usage: elevator nfloors nelevators interarrival opentime floor_to_floor duration seed\n");
-  if (s != NULL) fprintf(stderr, "%s\n", s);
-  exit(1);
+  Elevator_Simulation *es;
+  Arrival *a;
+  Person *p;
+  int i;
+
+  es = (Elevator_Simulation *) arg;
+  for (i = 0; i < SIM(es)->narrivals; i++) {
+    a = &SIM(es)->arrivals[i];
+    finesleep_sleep_until_ns(es->fs, (long long) (a->time * 1000000000.0 + 0.5));
+    if (!admit_person(es)) break;
+    p = new_person(es);
+    p->from = a->from;
+    p->to = a->to;
+    start_person(es, p, i);
+  }
+  finesleep_thread_exit(es->fs);
+  return NULL;
 }
 
-main(int argc, char **argv)
-{
-  Elevator_Simulation ES, *es;
-  pthread_t tid;
-  int i;
-  Elevator *e;
-  double duration;
-  
-  long seed;
-  es = &ES;
+/* Stops the arrivals and waits, for up to r->drain simulated seconds, for
+   everyone who is still in the building to finish.  admit_person() counts
+   people as started in the same critical section that checks draining,
+   so no one can be missed. */
 
-  if (argc != 8) usage(NULL);
+static void drain(Elevator_Simulation *es, double bound)
+{
+  double deadline, left;
 
-  if (sscanf(argv[1], "%d", &es->nfloors) != 1 || es->nfloors <= 1) {
-    usage("Bad nfloors (must be > 1)");
-  }
-  if (sscanf(argv[2], "%d", &es->nelevators) != 1 || es->nelevators <= 0) {
-    usage("Bad nelevators (must be > 0)");
-  }
-  if (sscanf(argv[3], "%lf", &es->interarrival_time) != 1 || es->interarrival_time <= 0) {
-    usage("Bad interarrival (must be > 0)");
-  }
-  if (sscanf(argv[4], "%lf", &es->door_time) != 1 || es->door_time <= 0) {
-    usage("Bad opentime (must be > 0)");
-  }
-  if (sscanf(argv[5], "%lf", &es->floor_to_floor_time) != 1 || es->floor_to_floor_time <= 0) {
-    usage("Bad floor_to_floor (must be > 0)");
+  pthread_mutex_lock(es->lock);
+  SIM(es)->draining = 1;
+  deadline = finesleep_time(es->fs) + bound;
+  while (es->npeople_finished < es->npeople_started) {
+    left = deadline - finesleep_time(es->fs);
+    if (left <= 0) break;
+    if (finesleep_cond_timedwait(es->fs, &SIM(es)->drained, es->lock, left) != 0) break;
   }
-  if (sscanf(argv[6], "%lf", &duration) != 1 || duration <= 0) {
-    usage("Bad duration (must be > 0)");
+  pthread_mutex_unlock(es->lock);
+}
+
+/* With -q there's no output, so this is all there is: how many of each
+   event there were, how fast they went by in real time, and the
+   latencies.  Nothing is printed until the simulation is over. */
+
+static void print_summary(Sim *sim, FILE *f, double elapsed)
+{
+  Elevator_Run *r;
+  long long n, total;
+  int i;
+
+  r = sim->run;
+  fprintf(f, "Simulation Over.  %d Started.  %d Finished.  %d still in the building.\n",
+          r->npeople_started, r->npeople_finished, r->npeople_started - r->npeople_finished);
+  total = 0;
+  for (i = 0; i < TR_NTYPES; i++) {
+    n = __atomic_load_n(&sim->counts[i].n, __ATOMIC_RELAXED);
+    fprintf(f, "  %-16s %12lld\n", trace_type(i), n);
+    total += n;
   }
-  if (sscanf(argv[7], "%ld", &seed) != 1) {
-    usage("Bad seed");
-    if (seed == -1) seed = time(0);
+  fprintf(f, "%lld events in %.3lf seconds of real time: %.0lf per second\n",
+          total, elapsed, (elapsed > 0) ? total / elapsed : 0);
+  hist_print(sim->wait, f, "Wait (arrival to boarding)", 1000000000.0, "s");
+  hist_print(sim->ride, f, "Ride (boarding to getting off)", 1000000000.0, "s");
+}
+
+/* Sets up a simulation, runs it for its duration (and drain), and then
+   halts its clock, which ends all of its threads (see finesleep_halt()).
+   If they all go, the simulation's memory is freed -- except whatever
+   your procedures hang off the v fields. */
+
+void run_simulation(Elevator_Run *r)
+{
+  Sim *sim;
+  Elevator_Simulation *es;
+  Elevator *e;
+  Dllist ptr;
+  pthread_t tid;
+  struct timespec start, end;
+  int i;
+
+  if (posix_memalign((void **) &sim, 64, sizeof(Sim)) != 0) {
+    fprintf(stderr, "Out of memory for a simulation\n");
+    exit(1);
   }
-  srand48(seed);
+  memset(sim->counts, 0, sizeof(sim->counts));
+  sim->run = r;
+  es = &sim->es;
+  es->sim = (void *) sim;
+  es->nfloors = r->nfloors;
+  es->nelevators = r->nelevators;
+  es->interarrival_time = r->interarrival_time;
+  es->door_time = r->door_time;
+  es->floor_to_floor_time = r->floor_to_floor_time;
+  for (i = 0; i < ES_NRNG; i++) rng_seed(&es->rng[i], r->seed, i);
   es->lock = talloc(pthread_mutex_t, 1);
   pthread_mutex_init(es->lock, NULL);
+  lockprof_register(es->lock, "es->lock");
   es->npeople_started = 0;
   es->npeople_finished = 0;
 
-  FINESLEEPER = finesleep_initialize(1);
+  if (r->speed > 0) {
+    es->fs = finesleep_initialize_speed(0, r->speed);
+  } else {
+    es->fs = finesleep_initialize(FINESLEEP_CHEAT | FINESLEEP_WHEEL);
+  }
+  sim->slab = new_person_slab();
+  sim->pool = (r->flags & ER_POOL) ? new_person_pool() : NULL;
+  sim->log = NULL;
+  sim->checker = (r->flags & ER_CHECK) ? new_checker("Record") : NULL;
+  sim->nrecords = 0;
+  if (r->out != NULL) {
+    sim->log = new_evlog(r->out, sizeof(Trace_Record), (r->flags & ER_BINARY) ? write_binary : write_text,
+                         (void *) sim);
+  } else if (sim->checker != NULL) {
+    sim->log = new_evlog(NULL, sizeof(Trace_Record), write_nothing, (void *) sim);
+  }
+  sim->elevators = new_dllist();
+  sim->wait = new_histogram();
+  sim->ride = new_histogram();
+  sim->draining = 0;
+  pthread_cond_init(&sim->drained, NULL);
+  sim->arrivals = NULL;
+  if (r->replay != NULL) read_arrivals(sim, r->replay);
   initialize_simulation(es);
 
   for (i = 0; i < es->nelevators; i++) {
@@ -329,27 +772,363 @@ main(int argc, char **argv)
     e->people = new_dllist();
     e->lock = talloc(pthread_mutex_t, 1);
     pthread_mutex_init(e->lock, NULL);
+    lockprof_register(e->lock, "e->lock");
     e->cond = talloc(pthread_cond_t, 1);
     pthread_cond_init(e->cond, NULL);
     e->es = es;
+    dll_append(sim->elevators, new_jval_v((void *) e));
     initialize_elevator(e);
+    finesleep_thread_add(es->fs);
     if (pthread_create(&tid, NULL, elevator, (void *) e) != 0) {
-      printf("Pthread create for elevator %d failed\n", i);
-      exit(1);
+      fprintf(stderr, "Pthread create for elevator %d failed\n", i);
+      die(es);
     }
     pthread_detach(tid);
   }
 
-  if (pthread_create(&tid, NULL, person_gen, (void *) es) != 0) {
-    printf("Pthread create for person_gen failed\n");
-    exit(1);
+  finesleep_thread_add(es->fs);
+  if (pthread_create(&tid, NULL, (sim->arrivals != NULL) ? replay_gen : person_gen, (void *) es) != 0) {
+    fprintf(stderr, "Pthread create for person_gen failed\n");
+    die(es);
   }
   pthread_detach(tid);
 
-  finesleep_sleep(FINESLEEPER, duration);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  finesleep_sleep(es->fs, r->duration);
+  if (r->drain > 0) drain(es, r->drain);
   pthread_mutex_lock(es->lock);
-  printf("%8.3lf: Simulation Over. %10d Started.  %10d Finished.\n", finesleep_time(FINESLEEPER),
-          es->npeople_started, es->npeople_finished);
-  exit(0);
+  r->npeople_started = es->npeople_started;
+  r->npeople_finished = es->npeople_finished;
   pthread_mutex_unlock(es->lock);
+  log_event(es, TR_OVER, finesleep_time_ns(es->fs), 0, r->npeople_started, r->npeople_finished);
+  if (sim->log != NULL) evlog_close(sim->log);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  r->wait_p50 = hist_percentile(sim->wait, 50) / 1000000000.0;
+  r->wait_p99 = hist_percentile(sim->wait, 99) / 1000000000.0;
+  r->ride_p50 = hist_percentile(sim->ride, 50) / 1000000000.0;
+  r->ride_p99 = hist_percentile(sim->ride, 99) / 1000000000.0;
+  if ((r->flags & ER_LATENCY) && !(r->flags & ER_SUMMARY)) {    /* The summary has them */
+    hist_print(sim->wait, stderr, "Wait (arrival to boarding)", 1000000000.0, "s");
+    hist_print(sim->ride, stderr, "Ride (boarding to getting off)", 1000000000.0, "s");
+    fprintf(stderr, "%d of %d people still in the building\n",
+            r->npeople_started - r->npeople_finished, r->npeople_started);
+  }
+  if (r->flags & ER_LATENESS) finesleep_report(es->fs, stderr);
+  if (r->flags & ER_SUMMARY) {
+    print_summary(sim, stdout, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  }
+
+  if (!finesleep_halt(es->fs)) return;
+
+  finesleep_free(es->fs);
+  if (sim->log != NULL) evlog_free(sim->log);
+  if (sim->checker != NULL) free_checker(sim->checker);
+  if (sim->pool != NULL) free_person_pool(sim->pool);
+  free_person_slab(sim->slab);
+  dll_traverse(ptr, sim->elevators) {
+    e = (Elevator *) ptr->val.v;
+    free_dllist(e->people);
+    lockprof_forget(e->lock);
+    pthread_mutex_destroy(e->lock);
+    free(e->lock);
+    pthread_cond_destroy(e->cond);
+    free(e->cond);
+    free(e);
+  }
+  free_dllist(sim->elevators);
+  if (sim->arrivals != NULL) free(sim->arrivals);
+  free_histogram(sim->wait);
+  free_histogram(sim->ride);
+  pthread_cond_destroy(&sim->drained);
+  lockprof_forget(es->lock);
+  pthread_mutex_destroy(es->lock);
+  free(es->lock);
+  free(sim);
+}
+
+/* Runs the simulations on nthreads threads, each of which takes the next
+   one that hasn't been started, until they are all done.  Each has its
+   own clock, which only waits for its own threads, so how many run at
+   once doesn't change what they do: -j 8 prints what -j 1 does. */
+
+typedef struct {
+  Elevator_Run *runs;
+  int n;
+  int next;
+} Run_Queue;
+
+static void *run_worker(void *arg)
+{
+  Run_Queue *q;
+  int i;
+
+  q = (Run_Queue *) arg;
+  while ((i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->n) {
+    run_simulation(&q->runs[i]);
+  }
+  return NULL;
+}
+
+void run_simulations(Elevator_Run *runs, int n, int nthreads)
+{
+  Run_Queue q;
+  pthread_t *tids;
+  int i;
+
+  q.runs = runs;
+  q.n = n;
+  q.next = 0;
+  if (nthreads > n) nthreads = n;
+  tids = talloc(pthread_t, nthreads);
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&tids[i], NULL, run_worker, (void *) &q) != 0) {
+      perror("run_simulations: pthread_create");
+      exit(1);
+    }
+  }
+  for (i = 0; i < nthreads; i++) pthread_join(tids[i], NULL);
+  free(tids);
+}
+
+void usage(char *s)
+{
+  fprintf(stderr, "usage: elevator [options] nfloors nelevators interarrival opentime floor_to_floor duration seed\n");
+  fprintf(stderr, "       elevator [options] -m runs-file\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -s speed   Run in real time, sped up by speed, instead of virtual time\n");
+  fprintf(stderr, "  -l         At the end, print how late the clock's sleeps woke up on stderr\n");
+  fprintf(stderr, "  -p         Run people on a pool of small-stack worker threads, not a thread each\n");
+  fprintf(stderr, "  -d secs    At the end, stop the arrivals and go on for up to secs more, until\n");
+  fprintf(stderr, "             everyone is done.  Implies -w.\n");
+  fprintf(stderr, "  -w         At the end, print the distributions of wait and ride times on stderr\n");
+  fprintf(stderr, "  -q         Headless: print nothing during the run, and only a summary of the\n");
+  fprintf(stderr, "             event counts, the event rate and the latencies at the end\n");
+  fprintf(stderr, "  -c         Check the simulation as it runs, as double-check does, and stop\n");
+  fprintf(stderr, "             at the first error.  With -m, this works without output files.\n");
+  fprintf(stderr, "  -k         Profile the mutexes, and print how contended each kind was on stderr\n");
+  fprintf(stderr, "             at the end, or whenever the process gets SIGUSR1 (see lockprof.h)\n");
+  fprintf(stderr, "  -b         Write binary trace records (trace.h) instead of text -- see trace2text\n");
+  fprintf(stderr, "  -t profile Traffic: uniform (the default), up, down, lunch, or up,down -- the\n");
+  fprintf(stderr, "             fractions of trips up from and down to the lobby (see traffic.h)\n");
+  fprintf(stderr, "  -f w1,...  Floor weights, one per floor, for choosing where trips start and end\n");
+  fprintf(stderr, "  -u k,on,off Bursts: arrivals come k times as fast in bursts averaging on seconds,\n");
+  fprintf(stderr, "             which come on average off seconds apart\n");
+  fprintf(stderr, "  -r file    Play back the arrivals in file, one \"arrival_time from to\" per line,\n");
+  fprintf(stderr, "             instead of drawing them.  interarrival is then ignored.\n");
+  fprintf(stderr, "  -m file    Run many simulations at once.  Each line of the file has the arguments\n");
+  fprintf(stderr, "             above (the seed is optional, default 1), optionally followed by a file\n");
+  fprintf(stderr, "             for the output, as in runs.txt.  One summary line per simulation, with\n");
+  fprintf(stderr, "             its wait and ride time percentiles, is printed on standard output.\n");
+  fprintf(stderr, "  -j n       With -m, run n simulations at a time (default: one per core)\n");
+  if (s != NULL) fprintf(stderr, "%s\n", s);
+  exit(1);
+}
+
+/* Reads the first six parameters of a simulation from argv[0..5].  The
+   seed is read by read_seed(). */
+
+void read_run(Elevator_Run *r, char **argv)
+{
+  if (sscanf(argv[0], "%d", &r->nfloors) != 1 || r->nfloors <= 1) {
+    usage("Bad nfloors (must be > 1)");
+  }
+  if (sscanf(argv[1], "%d", &r->nelevators) != 1 || r->nelevators <= 0) {
+    usage("Bad nelevators (must be > 0)");
+  }
+  if (sscanf(argv[2], "%lf", &r->interarrival_time) != 1 || r->interarrival_time <= 0) {
+    usage("Bad interarrival (must be > 0)");
+  }
+  if (sscanf(argv[3], "%lf", &r->door_time) != 1 || r->door_time <= 0) {
+    usage("Bad opentime (must be > 0)");
+  }
+  if (sscanf(argv[4], "%lf", &r->floor_to_floor_time) != 1 || r->floor_to_floor_time <= 0) {
+    usage("Bad floor_to_floor (must be > 0)");
+  }
+  if (sscanf(argv[5], "%lf", &r->duration) != 1 || r->duration <= 0) {
+    usage("Bad duration (must be > 0)");
+  }
+}
+
+/* The whole of s has to be the number: in a runs file, "5out.txt" is an
+   output file, not seed 5.  A seed of -1 means the time. */
+
+int read_seed(Elevator_Run *r, char *s)
+{
+  char *end;
+  long seed;
+
+  seed = strtol(s, &end, 10);
+  if (end == s || *end != '\0') return 0;
+  r->seed = (seed == -1) ? time(0) : seed;
+  return 1;
+}
+
+main(int argc, char **argv)
+{
+  Elevator_Run R, *r, *runs;
+  double speed, drain_time;
+  int flags, nthreads, nruns, nf, i;
+  char *runs_file, *replay;
+  Traffic *traffic;
+  IS is;
+  Dllist lines, ptr;
+
+  speed = 0;
+  drain_time = 0;
+  flags = 0;
+  runs_file = NULL;
+  replay = NULL;
+  traffic = NULL;
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  while (argc > 1 && argv[1][0] == '-' && isalpha(argv[1][1])) {
+    if (strcmp(argv[1], "-s") == 0 && argc > 2) {
+      if (sscanf(argv[2], "%lf", &speed) != 1 || speed <= 0) usage("Bad speed (must be > 0)");
+      argc -= 2;
+      argv += 2;
+    } else if (strcmp(argv[1], "-d") == 0 && argc > 2) {
+      if (sscanf(argv[2], "%lf", &drain_time) != 1 || drain_time <= 0) usage("Bad -d (must be > 0)");
+      flags |= ER_LATENCY;
+      argc -= 2;
+      argv += 2;
+    } else if (strcmp(argv[1], "-r") == 0 && argc > 2) {
+      replay = argv[2];
+      argc -= 2;
+      argv += 2;
+    } else if ((strcmp(argv[1], "-t") == 0 || strcmp(argv[1], "-f") == 0 ||
+                strcmp(argv[1], "-u") == 0) && argc > 2) {
+      if (traffic == NULL) {
+        traffic = talloc(Traffic, 1);
+        traffic_init(traffic);
+      }
+      if (argv[1][1] == 't' && !traffic_profile(traffic, argv[2])) usage("Bad -t profile");
+      if (argv[1][1] == 'f' && !traffic_weights(traffic, argv[2])) usage("Bad -f floor weights");
+      if (argv[1][1] == 'u' && !traffic_bursts(traffic, argv[2])) usage("Bad -u bursts");
+      argc -= 2;
+      argv += 2;
+    } else if (strcmp(argv[1], "-m") == 0 && argc > 2) {
+      runs_file = argv[2];
+      argc -= 2;
+      argv += 2;
+    } else if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+      if (sscanf(argv[2], "%d", &nthreads) != 1 || nthreads <= 0) usage("Bad -j (must be > 0)");
+      argc -= 2;
+      argv += 2;
+    } else if (strcmp(argv[1], "-l") == 0) {
+      flags |= ER_LATENESS;
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-q") == 0) {
+      flags |= ER_SUMMARY;
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-c") == 0) {
+      flags |= ER_CHECK;
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-k") == 0) {
+      lockprof_enable(SIGUSR1);
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-w") == 0) {
+      flags |= ER_LATENCY;
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-b") == 0) {
+      flags |= ER_BINARY;
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-p") == 0) {
+      flags |= ER_POOL;
+      argc--;
+      argv++;
+    } else {
+      usage("Bad option");
+    }
+  }
+
+  if (runs_file == NULL) {
+    if (argc != 8) usage(NULL);
+    r = &R;
+    read_run(r, argv+1);
+    if (!read_seed(r, argv[7])) usage("Bad seed");
+    if (traffic != NULL && !traffic_check(traffic, r->nfloors)) {
+      usage("The -f weights need one per floor, with enough of them nonzero");
+    }
+    r->speed = speed;
+    r->drain = drain_time;
+    r->replay = replay;
+    r->traffic = traffic;
+    r->flags = flags;
+    r->out = (flags & ER_SUMMARY) ? NULL : stdout;
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    run_simulation(r);
+    if (lockprof_enabled()) lockprof_report(stderr);
+    exit(0);
+  }
+
+  if (argc != 1) usage(NULL);
+  is = new_inputstruct(runs_file);
+  if (is == NULL) {
+    perror(runs_file);
+    exit(1);
+  }
+  lines = new_dllist();
+  while (get_line(is) >= 0) {
+    if (is->NF == 0) continue;
+    r = talloc(Elevator_Run, 1);
+    r->seed = 1;
+    nf = 6;
+    if (is->NF > 6 && read_seed(r, is->fields[6])) nf = 7;
+    if (is->NF < 6 || is->NF > nf+1) {
+      fprintf(stderr, "%s line %d: need six parameters, an optional seed and an optional output file\n",
+              runs_file, is->line);
+      exit(1);
+    }
+    read_run(r, is->fields);
+    if (traffic != NULL && !traffic_check(traffic, r->nfloors)) {
+      fprintf(stderr, "%s line %d: the -f weights don't fit %d floors\n", runs_file, is->line, r->nfloors);
+      exit(1);
+    }
+    r->speed = speed;
+    r->drain = drain_time;
+    r->replay = replay;
+    r->traffic = traffic;
+    r->flags = flags & ~(ER_LATENCY | ER_SUMMARY);    /* The percentiles go on the summary lines */
+    r->out = NULL;
+    if (is->NF > nf) {
+      r->out = fopen(is->fields[nf], "w");
+      if (r->out == NULL) {
+        perror(is->fields[nf]);
+        exit(1);
+      }
+      setvbuf(r->out, NULL, _IOFBF, 1 << 16);
+    }
+    dll_append(lines, new_jval_v((void *) r));
+  }
+  jettison_inputstruct(is);
+
+  nruns = 0;
+  dll_traverse(ptr, lines) nruns++;
+  runs = talloc(Elevator_Run, nruns);
+  i = 0;
+  dll_traverse(ptr, lines) {
+    runs[i++] = *((Elevator_Run *) ptr->val.v);
+    free(ptr->val.v);
+  }
+  free_dllist(lines);
+
+  run_simulations(runs, nruns, nthreads);
+  if (lockprof_enabled()) lockprof_report(stderr);
+
+  for (i = 0; i < nruns; i++) {
+    r = &runs[i];
+    if (r->out != NULL) fclose(r->out);
+    printf("%d %d %.3lf %.3lf %.3lf %.3lf %ld: %10d Started.  %10d Finished.  "
+           "Wait p50 %.3lf p99 %.3lf.  Ride p50 %.3lf p99 %.3lf.\n",
+           r->nfloors, r->nelevators, r->interarrival_time, r->door_time, r->floor_to_floor_time,
+           r->duration, r->seed, r->npeople_started, r->npeople_finished,
+           r->wait_p50, r->wait_p99, r->ride_p50, r->ride_p99);
+  }
+  exit(0);
 }
@@ -0,0 +1,153 @@
+/* evlog.c
+   Asynchronous event log.  See evlog.h.
+
+   The ring is a bounded multi-producer, single-consumer queue.  A
+   producer takes a ticket by incrementing tail; ticket t uses slot
+   t % EVLOG_SIZE.  Each slot's seq says whose turn it is: t when the slot
+   is free for ticket t, and t+1 once ticket t's record is in it.  The
+   writer frees the slot by setting seq to t + EVLOG_SIZE.  Taking the
+   ticket is the only contended operation, and it is a single atomic add.
+
+   The writer spins briefly when the ring is empty, then naps.  It flushes
+   the file whenever it catches up, so in real time the output is never
+   more than a nap behind.
+
+   Once the log is closed, claims return NULL rather than a ticket, so
+   that threads that are still logging don't wait forever for the writer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "evlog.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+#define EVLOG_SIZE 4096          /* Must be a power of two */
+#define EVLOG_SPINS 64
+#define EVLOG_NAP_NSEC 50000
+
+struct evlog {
+  FILE *f;
+  Evlog_Render render;
+  void *arg;
+  int size;                      /* Of a record */
+  char *ring;                    /* EVLOG_SIZE records */
+  long long *seq;                /* One per slot */
+  long long tail;                /* Next ticket */
+  long long head;                /* Next ticket for the writer -- only it touches this */
+  long long close;               /* Ticket of evlog_close()'s record, or -1 */
+  pthread_t writer;
+  pthread_mutex_t close_lock;    /* So that only one thread stops the writer */
+};
+
+static void *evlog_writer(void *arg)
+{
+  Evlog l;
+  long long *seq;
+  struct timespec nap;
+  int spins;
+
+  l = (Evlog) arg;
+  nap.tv_sec = 0;
+  nap.tv_nsec = EVLOG_NAP_NSEC;
+  spins = 0;
+
+  while (1) {
+    seq = &l->seq[l->head & (EVLOG_SIZE-1)];
+    if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != l->head + 1) {
+      if (spins == 0 && l->f != NULL) fflush(l->f);
+      if (spins < EVLOG_SPINS) {
+        spins++;
+        sched_yield();
+      } else {
+        nanosleep(&nap, NULL);
+      }
+      continue;
+    }
+    spins = 0;
+    if (l->head == __atomic_load_n(&l->close, __ATOMIC_ACQUIRE)) {
+      if (l->f != NULL) fflush(l->f);
+      return NULL;
+    }
+    l->render(l->arg, l->f, l->ring + (l->head & (EVLOG_SIZE-1)) * l->size);
+    __atomic_store_n(seq, l->head + EVLOG_SIZE, __ATOMIC_RELEASE);
+    l->head++;
+  }
+}
+
+Evlog new_evlog(FILE *f, int size, Evlog_Render render, void *arg)
+{
+  Evlog l;
+  long long i;
+
+  l = talloc(struct evlog, 1);
+  l->f = f;
+  l->render = render;
+  l->arg = arg;
+  l->size = size;
+  l->ring = talloc(char, EVLOG_SIZE * size);
+  l->seq = talloc(long long, EVLOG_SIZE);
+  for (i = 0; i < EVLOG_SIZE; i++) l->seq[i] = i;
+  l->tail = 0;
+  l->head = 0;
+  l->close = -1;
+  pthread_mutex_init(&l->close_lock, NULL);
+
+  if (pthread_create(&l->writer, NULL, evlog_writer, (void *) l) != 0) {
+    perror("evlog: pthread_create");
+    exit(1);
+  }
+  return l;
+}
+
+static long long evlog_ticket(Evlog l)
+{
+  long long t;
+
+  t = __atomic_fetch_add(&l->tail, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&l->seq[t & (EVLOG_SIZE-1)], __ATOMIC_ACQUIRE) != t) sched_yield();
+  return t;
+}
+
+void *evlog_claim(Evlog l)
+{
+  if (__atomic_load_n(&l->close, __ATOMIC_ACQUIRE) >= 0) return NULL;
+  return l->ring + (evlog_ticket(l) & (EVLOG_SIZE-1)) * l->size;
+}
+
+/* The ticket is recovered from the slot's seq, which still holds it
+   while the slot is claimed. */
+
+void evlog_commit(Evlog l, void *record)
+{
+  long long *seq;
+
+  seq = &l->seq[((char *) record - l->ring) / l->size];
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+void evlog_close(Evlog l)
+{
+  long long t;
+
+  pthread_mutex_lock(&l->close_lock);
+  if (l->close < 0) {
+    t = evlog_ticket(l);
+    __atomic_store_n(&l->close, t, __ATOMIC_RELEASE);
+    __atomic_store_n(&l->seq[t & (EVLOG_SIZE-1)], t + 1, __ATOMIC_RELEASE);
+    pthread_join(l->writer, NULL);
+  }
+  pthread_mutex_unlock(&l->close_lock);
+}
+
+void evlog_free(Evlog l)
+{
+  free(l->ring);
+  free(l->seq);
+  pthread_mutex_destroy(&l->close_lock);
+  free(l);
+}
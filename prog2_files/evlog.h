@@ -0,0 +1,41 @@
+/* evlog.h
+   An asynchronous event log.  Threads put fixed-size records into a
+   lock-free ring, and a writer thread hands them to a render function,
+   which writes them to the file (as text, or raw), so the threads that
+   log never take a lock or make a system call.  The writer flushes the
+   file whenever it catches up, so give the file a big buffer (setvbuf).
+
+   The records are whatever the caller wants -- new_evlog() just needs
+   their size.  The render function is called with new_evlog()'s arg, and
+   f may be NULL, if the records are only needed for what render does
+   with them.  To log, get a record with evlog_claim(), fill it in, and
+   hand it back with evlog_commit().  Records are rendered in the order in
+   which they were claimed.  If the ring is full, evlog_claim() waits for
+   the writer.
+
+   evlog_close() logs nothing more: it waits until every record claimed
+   before it has been written, flushes the file and stops the writer.
+   After it, evlog_claim() returns NULL, and there is nothing to fill in
+   or commit.  So call it when the output is finished -- including on
+   errors, so that it is complete.  It may be called more than once;
+   later calls just wait for the first.
+   evlog_free() may be called once no thread can log to l any more.  It
+   doesn't close the file.
+ */
+
+#ifndef _EVLOG_H_
+#define _EVLOG_H_
+
+#include <stdio.h>
+
+typedef void (*Evlog_Render)(void *arg, FILE *f, void *record);
+
+typedef struct evlog *Evlog;
+
+extern Evlog new_evlog(FILE *f, int size, Evlog_Render render, void *arg);
+extern void *evlog_claim(Evlog l);
+extern void evlog_commit(Evlog l, void *record);
+extern void evlog_close(Evlog l);
+extern void evlog_free(Evlog l);
+
+#endif
@@ -1,100 +1,595 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/types.h>
-#include <sys/time.h>
-#include <unistd.h>
+#include <time.h>
 #include "jrb.h"
+#include "timewheel.h"
+#include "histogram.h"
+#include "finesleep.h"
 #define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
 
+/* How long (real time) finesleep_halt() waits for the threads to go. */
+
+#define FS_HALT_USEC 1000000
+
+/* One of these lives on the stack of each sleeping thread, and is the val
+   of its node in the tree (or its timer in the wheel).  The clock signals
+   exactly that thread.  The sleeper waits on its own lock rather than
+   fs->lock, so waking it up doesn't make it fight for fs->lock again.
+
+   Threads in finesleep_cond_wait() use one too: it goes on a FIFO of the
+   waiters on that condition variable, and also in the timer store if the
+   wait has a timeout. */
+
+typedef struct sleeper {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int woken;
+  long long deadline;
+  JRB node;
+  TW_Timer t;
+  struct sleeper *batch;      /* Links the sleepers that the clock wakes together */
+  int waiting;                /* In finesleep_cond_wait() rather than finesleep_sleep() */
+  int timed;                  /* A waiter that is also in the timer store */
+  int timedout;
+  int queued;                 /* Still on the FIFO for c */
+  pthread_cond_t *c;
+  JRB cnode;                  /* c's node in fs->conds */
+  struct sleeper *qnext;
+  struct sleeper *qprev;
+} Sleeper;
+
 typedef struct {
-  int fd[2];
   int cheat;
-  double stime;
-  JRB tree;
+  long long base;             /* Real mode: CLOCK_MONOTONIC at startup, in ns */
+  double speed;               /* Real mode: simulated seconds per real second */
+  long long now;              /* Cheat mode: virtual time, in ns.  See below. */
+  JRB tree;                   /* Pending deadlines: either the tree */
+  Timewheel wheel;            /* or the wheel (FINESLEEP_WHEEL) */
+  int npending;
   pthread_mutex_t *lock;
+  pthread_cond_t *idle;       /* Wakes the clock thread */
+  int nthreads;               /* Threads taking part in the simulation */
+  int nsleeping;              /* How many of them are in finesleep_sleep() */
+  int nblocked;               /* How many are in finesleep_cond_wait() */
+  JRB conds;                  /* Keyed by pthread_cond_t *: the first waiter */
+  int done;
+  int halted;                 /* finesleep_halt() was called */
+  pthread_t clock;
+  Histogram late;             /* Actual minus requested wake time of every sleep */
 } Finesleep;
 
-void *finesleep_initialize(int cheat)
+static long long monotonic_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ns(Jval a, Jval b)
+{
+  if (a.l < b.l) return -1;
+  if (a.l > b.l) return 1;
+  return 0;
+}
+
+static int cmp_ptr(Jval a, Jval b)
+{
+  if (a.v < b.v) return -1;
+  if (a.v > b.v) return 1;
+  return 0;
+}
+
+/* The virtual time is only written by the clock thread, with fs->lock held,
+   but it's read all over the place (every line of output), so readers don't
+   take the lock: it is a single 64-bit word, stored and loaded atomically. */
+
+static void set_now(Finesleep *fs, long long now)
+{
+  __atomic_store_n(&fs->now, now, __ATOMIC_RELEASE);
+}
+
+static long long get_now(Finesleep *fs)
+{
+  return __atomic_load_n(&fs->now, __ATOMIC_ACQUIRE);
+}
+
+/* The timer store.  These are all called with fs->lock held. */
+
+static void fs_insert(Finesleep *fs, Sleeper *s)
+{
+  Jval k;
+
+  if (fs->wheel != NULL) {
+    s->t.deadline = s->deadline;
+    s->t.v = (void *) s;
+    tw_insert(fs->wheel, &s->t);
+  } else {
+    k.l = s->deadline;
+    s->node = jrb_insert_gen(fs->tree, k, new_jval_v((void *) s), cmp_ns);
+  }
+  fs->npending++;
+}
+
+static void fs_delete(Finesleep *fs, Sleeper *s)
+{
+  if (fs->wheel != NULL) {
+    tw_delete(fs->wheel, &s->t);
+  } else {
+    jrb_delete_node(s->node);
+  }
+  fs->npending--;
+}
+
+static Sleeper *fs_first(Finesleep *fs)
+{
+  if (fs->npending == 0) return NULL;
+  if (fs->wheel != NULL) return (Sleeper *) tw_first(fs->wheel)->v;
+  return (Sleeper *) jrb_first(fs->tree)->val.v;
+}
+
+/* The next one due at time t, if there is one.  Looking further ahead
+   with fs_first() would move the wheel past t, and sleeps that start at
+   t may end before wherever it stopped. */
+
+static Sleeper *fs_next_at(Finesleep *fs, long long t)
+{
+  TW_Timer *tt;
+  Sleeper *s;
+
+  if (fs->npending == 0) return NULL;
+  if (fs->wheel != NULL) {
+    tt = tw_first_by(fs->wheel, t);
+    return (tt == NULL) ? NULL : (Sleeper *) tt->v;
+  }
+  s = (Sleeper *) jrb_first(fs->tree)->val.v;
+  return (s->deadline == t) ? s : NULL;
+}
+
+/* The waiters on each condition variable, in FIFO order.  Again, these
+   are called with fs->lock held. */
+
+static void cq_append(Finesleep *fs, Sleeper *s)
+{
+  JRB ptr;
+  Sleeper *head;
+
+  ptr = jrb_find_gen(fs->conds, new_jval_v((void *) s->c), cmp_ptr);
+  if (ptr == NULL) {
+    s->cnode = jrb_insert_gen(fs->conds, new_jval_v((void *) s->c), new_jval_v((void *) s), cmp_ptr);
+    s->qnext = s;
+    s->qprev = s;
+  } else {
+    head = (Sleeper *) ptr->val.v;
+    s->cnode = ptr;
+    s->qnext = head;
+    s->qprev = head->qprev;
+    s->qnext->qprev = s;
+    s->qprev->qnext = s;
+  }
+  s->queued = 1;
+}
+
+static void cq_delete(Finesleep *fs, Sleeper *s)
+{
+  if (s->qnext == s) {
+    jrb_delete_node(s->cnode);
+  } else {
+    s->qnext->qprev = s->qprev;
+    s->qprev->qnext = s->qnext;
+    if (s->cnode->val.v == (void *) s) s->cnode->val.v = (void *) s->qnext;
+  }
+  s->queued = 0;
+}
+
+static Sleeper *cq_first(Finesleep *fs, pthread_cond_t *c)
+{
+  JRB ptr;
+
+  ptr = jrb_find_gen(fs->conds, new_jval_v((void *) c), cmp_ptr);
+  return (ptr == NULL) ? NULL : (Sleeper *) ptr->val.v;
+}
+
+/* A thread that finds the clock halted leaves the simulation for good. */
+
+static int halted(Finesleep *fs)
+{
+  return __atomic_load_n(&fs->halted, __ATOMIC_ACQUIRE);
+}
+
+static void halt_exit(Finesleep *fs)
+{
+  pthread_mutex_lock(fs->lock);
+  fs->nthreads--;
+  pthread_cond_signal(fs->idle);
+  pthread_mutex_unlock(fs->lock);
+  pthread_exit(NULL);
+}
+
+static void wake(Sleeper *s)
+{
+  pthread_mutex_lock(&s->lock);
+  s->woken = 1;
+  pthread_cond_signal(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* The clock thread.  When every simulation thread is asleep or blocked in
+   finesleep_cond_wait(), nothing can
+   happen before the earliest deadline, so it jumps the virtual time straight
+   to it.  Everyone due at that instant is taken off the store in the same
+   critical section, and they are all woken, each through its own condition
+   variable, after fs->lock is released.
+
+   It never moves while a simulation thread is running, however long that
+   takes in real time, so the results don't depend on how busy the machine
+   is.  The flip side is that a thread that blocks anywhere else -- on a
+   mutex whose holder is asleep, say, or in a plain pthread_cond_wait() --
+   stops the clock for good. */
+
+static void *finesleep_clock(void *a)
 {
   Finesleep *fs;
-  struct timeval tv;
-  struct timezone tz;
+  Sleeper *s, *batch;
+  long long t;
+
+  fs = (Finesleep *) a;
+  pthread_mutex_lock(fs->lock);
+  while (!fs->done) {
+    if (fs->npending == 0 || fs->nsleeping + fs->nblocked < fs->nthreads) {
+      pthread_cond_wait(fs->idle, fs->lock);
+      continue;
+    }
+    s = fs_first(fs);
+    t = s->deadline;
+    set_now(fs, t);
+    batch = NULL;
+    do {
+      fs_delete(fs, s);
+      if (s->waiting) {
+        cq_delete(fs, s);
+        s->timedout = 1;
+        fs->nblocked--;
+      } else {
+        fs->nsleeping--;
+      }
+      s->batch = batch;
+      batch = s;
+      s = fs_next_at(fs, t);
+    } while (s != NULL);
+
+    pthread_mutex_unlock(fs->lock);
+    while (batch != NULL) {
+      s = batch;
+      batch = s->batch;
+      wake(s);
+    }
+    pthread_mutex_lock(fs->lock);
+  }
+  pthread_mutex_unlock(fs->lock);
+  return NULL;
+}
+
+void *finesleep_initialize(int flags)
+{
+  return finesleep_initialize_speed(flags, 1.0);
+}
+
+void *finesleep_initialize_speed(int flags, double speed)
+{
+  Finesleep *fs;
+  pthread_condattr_t ca;
 
   fs = talloc(Finesleep, 1);
-  fs->cheat = cheat;
+  fs->cheat = (flags & FINESLEEP_CHEAT);
+  fs->speed = speed;
   fs->tree = make_jrb();
+  fs->wheel = (flags & FINESLEEP_WHEEL) ? new_timewheel(0) : NULL;
+  fs->npending = 0;
   fs->lock = talloc(pthread_mutex_t, 1);
   pthread_mutex_init(fs->lock, NULL);
-  pipe(fs->fd);
-  if (cheat) {
-    fs->stime = 0;
-  } else {
-    gettimeofday(&tv, &tz);
-    fs->stime = tv.tv_usec;
-    fs->stime /= 1000000.0;
-    fs->stime += tv.tv_sec;
+  fs->idle = talloc(pthread_cond_t, 1);
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(fs->idle, &ca);
+  pthread_condattr_destroy(&ca);
+  fs->nthreads = 1;
+  fs->nsleeping = 0;
+  fs->nblocked = 0;
+  fs->conds = make_jrb();
+  fs->done = 0;
+  fs->halted = 0;
+  fs->now = 0;
+  fs->base = monotonic_ns();
+  fs->late = new_histogram();
+  if (fs->cheat) {
+    if (pthread_create(&fs->clock, NULL, finesleep_clock, (void *) fs) != 0) {
+      perror("finesleep_initialize: pthread_create");
+      exit(1);
+    }
   }
   return (void *) fs;
 }
-  
-void finesleep_sleep(void *a, double t)
+
+void finesleep_thread_add(void *a)
 {
   Finesleep *fs;
-  fd_set r;
-  struct timeval tv;
-  double newtime;
-  JRB ptr;
-  double diff;
+
+  fs = (Finesleep *) a;
+  pthread_mutex_lock(fs->lock);
+  fs->nthreads++;
+  pthread_mutex_unlock(fs->lock);
+}
+
+void finesleep_thread_exit(void *a)
+{
+  Finesleep *fs;
+
+  fs = (Finesleep *) a;
+  pthread_mutex_lock(fs->lock);
+  fs->nthreads--;
+  pthread_cond_signal(fs->idle);
+  pthread_mutex_unlock(fs->lock);
+}
+
+void finesleep_sleep_until_ns(void *a, long long deadline)
+{
+  Finesleep *fs;
+  Sleeper s;
+  long long target;
+  struct timespec ts;
 
   fs = (Finesleep *) a;
   if (fs->cheat) {
-    newtime = fs->stime + t;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    s.woken = 0;
+    s.waiting = 0;
     pthread_mutex_lock(fs->lock);
-    ptr = jrb_insert_dbl(fs->tree, newtime, new_jval_i(0));
-    diff = newtime - fs->stime;
+    if (fs->halted) {
+      pthread_mutex_unlock(fs->lock);
+      halt_exit(fs);
+    }
+    s.deadline = (deadline < fs->now) ? fs->now : deadline;
+    fs_insert(fs, &s);
+    fs->nsleeping++;
+    pthread_cond_signal(fs->idle);
+    pthread_mutex_unlock(fs->lock);
+
+    pthread_mutex_lock(&s.lock);
+    while (!s.woken) pthread_cond_wait(&s.cond, &s.lock);
+    pthread_mutex_unlock(&s.lock);
+    if (halted(fs)) halt_exit(fs);
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+    hist_add(fs->late, get_now(fs) - s.deadline);     /* A deadline already past isn't oversleep */
+    return;
+  }
+
+  /* In real time, the simulated time is always speed times the real time
+     since startup, so oversleeping never accumulates in the clock itself.
+     We also sleep to an absolute deadline, so neither being preempted
+     before going to sleep nor being interrupted adds to the sleep. */
+
+  target = fs->base + (long long) (deadline / fs->speed);
+  ts.tv_sec = target / 1000000000LL;
+  ts.tv_nsec = target % 1000000000LL;
+  if (halted(fs)) halt_exit(fs);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) ;
+  if (halted(fs)) halt_exit(fs);
+  hist_add(fs->late, finesleep_time_ns(fs) - deadline);
+}
+
+void finesleep_sleep_until(void *a, double t)
+{
+  finesleep_sleep_until_ns(a, (long long) (t * 1000000000.0 + 0.5));
+}
+
+void finesleep_sleep(void *a, double t)
+{
+  finesleep_sleep_until_ns(a, finesleep_time_ns(a) + (long long) (t * 1000000000.0 + 0.5));
+}
+
+/* Waits on c, with m held by the caller.  If timed is set, gives up at the
+   given (simulated) deadline and returns ETIMEDOUT. */
+
+static int cond_wait(Finesleep *fs, pthread_cond_t *c, pthread_mutex_t *m, int timed, long long deadline)
+{
+  Sleeper s;
+  pthread_condattr_t ca;
+  long long target;
+  struct timespec ts;
+
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&s.cond, &ca);
+  pthread_condattr_destroy(&ca);
+  s.woken = 0;
+  s.waiting = 1;
+  s.timed = (timed && fs->cheat);
+  s.timedout = 0;
+  s.c = c;
+
+  pthread_mutex_lock(fs->lock);
+  if (fs->halted) {
     pthread_mutex_unlock(fs->lock);
+    pthread_mutex_unlock(m);
+    halt_exit(fs);
+  }
+  cq_append(fs, &s);
+  if (s.timed) {
+    s.deadline = (deadline < fs->now) ? fs->now : deadline;
+    fs_insert(fs, &s);
+  }
+  fs->nblocked++;
+  pthread_cond_signal(fs->idle);
+  pthread_mutex_unlock(fs->lock);
+
+  /* We're on c's FIFO before m is released, so a signal sent by anyone
+     holding m from here on will find us. */
+
+  pthread_mutex_unlock(m);
+  pthread_mutex_lock(&s.lock);
+  if (timed && !fs->cheat) {
+    target = fs->base + (long long) (deadline / fs->speed);
+    ts.tv_sec = target / 1000000000LL;
+    ts.tv_nsec = target % 1000000000LL;
+    while (!s.woken) {
+      if (pthread_cond_timedwait(&s.cond, &s.lock, &ts) == ETIMEDOUT) break;
+    }
   } else {
-    diff = t;
-  }
-  while (1) {
-    tv.tv_sec = diff;
-    diff -= tv.tv_sec;
-    diff *= 1000000.0;
-    tv.tv_usec = diff;
-    FD_ZERO(&r);
-    FD_SET(fs->fd[0], &r);
-    select(fs->fd[0]+1, &r, NULL, NULL, &tv);
-    if (fs->cheat) {
-      pthread_mutex_lock(fs->lock);
-      if (fs->tree->flink->key.d == newtime) {
-        jrb_delete_node(ptr);
-        fs->stime = newtime;
-        pthread_mutex_unlock(fs->lock);
-        return;
-      } else {
-        diff = newtime - fs->tree->flink->key.d;
-        pthread_mutex_unlock(fs->lock);
-      }
-    } else {
-      return;
+    while (!s.woken) pthread_cond_wait(&s.cond, &s.lock);
+  }
+  pthread_mutex_unlock(&s.lock);
+
+  /* A real-time timeout.  If a signal got to us first, it's about to wake us. */
+
+  if (!s.woken) {
+    pthread_mutex_lock(fs->lock);
+    if (s.queued) {
+      cq_delete(fs, &s);
+      fs->nblocked--;
+      s.timedout = 1;
+      s.woken = 1;
     }
+    pthread_mutex_unlock(fs->lock);
+    pthread_mutex_lock(&s.lock);
+    while (!s.woken) pthread_cond_wait(&s.cond, &s.lock);
+    pthread_mutex_unlock(&s.lock);
   }
+
+  if (halted(fs)) halt_exit(fs);
+  pthread_cond_destroy(&s.cond);
+  pthread_mutex_destroy(&s.lock);
+  pthread_mutex_lock(m);
+  return (s.timedout) ? ETIMEDOUT : 0;
+}
+
+void finesleep_cond_wait(void *a, pthread_cond_t *c, pthread_mutex_t *m)
+{
+  cond_wait((Finesleep *) a, c, m, 0, 0);
+}
+
+int finesleep_cond_timedwait(void *a, pthread_cond_t *c, pthread_mutex_t *m, double t)
+{
+  return cond_wait((Finesleep *) a, c, m, 1, finesleep_time_ns(a) + (long long) (t * 1000000000.0 + 0.5));
+}
+
+/* Takes up to n waiters off c's FIFO (and their timers off the store), and
+   wakes them up.  They count as running from this moment, so the clock
+   can't move on before they've had their chance to run. */
+
+static void cond_wake(Finesleep *fs, pthread_cond_t *c, int n)
+{
+  Sleeper *s, *batch;
+
+  batch = NULL;
+  pthread_mutex_lock(fs->lock);
+  while (n > 0 && (s = cq_first(fs, c)) != NULL) {
+    cq_delete(fs, s);
+    if (s->timed) fs_delete(fs, s);
+    fs->nblocked--;
+    s->batch = batch;
+    batch = s;
+    n--;
+  }
+  pthread_mutex_unlock(fs->lock);
+
+  while (batch != NULL) {
+    s = batch;
+    batch = s->batch;
+    wake(s);
+  }
+}
+
+void finesleep_cond_signal(void *a, pthread_cond_t *c)
+{
+  cond_wake((Finesleep *) a, c, 1);
+}
+
+void finesleep_cond_broadcast(void *a, pthread_cond_t *c)
+{
+  cond_wake((Finesleep *) a, c, INT_MAX);
+}
+
+long long finesleep_time_ns(void *a)
+{
+  Finesleep *fs;
+
+  fs = (Finesleep *) a;
+  if (fs->cheat) return get_now(fs);
+  if (fs->speed == 1.0) return monotonic_ns() - fs->base;
+  return (long long) ((monotonic_ns() - fs->base) * fs->speed);
 }
 
 double finesleep_time(void *a)
+{
+  return finesleep_time_ns(a) / 1000000000.0;
+}
+
+void finesleep_report(void *a, FILE *f)
 {
   Finesleep *fs;
-  double now;
-  struct timeval tv;
-  struct timezone tz;
 
   fs = (Finesleep *) a;
-  if (fs->cheat) return fs->stime;
-  gettimeofday(&tv, &tz);
-  now = tv.tv_usec;
-  now /= 1000000.0;
-  now += tv.tv_sec;
-  return now - fs->stime;
+  hist_print(fs->late, f, "finesleep oversleep", 1000000.0, "ms");
+}
+
+/* Takes everyone off the timer store and the condition variables, wakes
+   them up, and stops the clock.  They (and anyone who calls in later)
+   then exit in halt_exit().  Threads that never come back to the clock
+   can't be stopped, so after FS_HALT_USEC, we give up on them. */
+
+int finesleep_halt(void *a)
+{
+  Finesleep *fs;
+  Sleeper *s, *batch;
+  long long deadline;
+  struct timespec ts;
+  int gone;
+
+  fs = (Finesleep *) a;
+  batch = NULL;
+  pthread_mutex_lock(fs->lock);
+  __atomic_store_n(&fs->halted, 1, __ATOMIC_RELEASE);
+  fs->done = 1;
+  while ((s = fs_first(fs)) != NULL) {
+    fs_delete(fs, s);
+    if (s->waiting) cq_delete(fs, s);
+    s->batch = batch;
+    batch = s;
+  }
+  while (!jrb_empty(fs->conds)) {
+    s = (Sleeper *) jrb_first(fs->conds)->val.v;
+    cq_delete(fs, s);
+    s->batch = batch;
+    batch = s;
+  }
+  pthread_cond_signal(fs->idle);
+  pthread_mutex_unlock(fs->lock);
+
+  while (batch != NULL) {
+    s = batch;
+    batch = s->batch;
+    wake(s);
+  }
+  if (fs->cheat) pthread_join(fs->clock, NULL);
+
+  deadline = monotonic_ns() + FS_HALT_USEC * 1000LL;
+  ts.tv_sec = deadline / 1000000000LL;
+  ts.tv_nsec = deadline % 1000000000LL;
+  pthread_mutex_lock(fs->lock);
+  while (fs->nthreads > 1) {
+    if (pthread_cond_timedwait(fs->idle, fs->lock, &ts) == ETIMEDOUT) break;
+  }
+  gone = (fs->nthreads <= 1);
+  pthread_mutex_unlock(fs->lock);
+  return gone;
 }
 
 void finesleep_free(void *a)
@@ -102,10 +597,20 @@ void finesleep_free(void *a)
   Finesleep *fs;
 
   fs = (Finesleep *) a;
-  close(fs->fd[0]);
-  close(fs->fd[1]);
+  if (fs->cheat && !fs->halted) {
+    pthread_mutex_lock(fs->lock);
+    fs->done = 1;
+    pthread_cond_signal(fs->idle);
+    pthread_mutex_unlock(fs->lock);
+    pthread_join(fs->clock, NULL);
+  }
   jrb_free_tree(fs->tree);
+  jrb_free_tree(fs->conds);
+  if (fs->wheel != NULL) free_timewheel(fs->wheel);
   pthread_mutex_destroy(fs->lock);
   free(fs->lock);
+  pthread_cond_destroy(fs->idle);
+  free(fs->idle);
+  free_histogram(fs->late);
   free(fs);
 }
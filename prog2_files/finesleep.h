@@ -1,7 +1,77 @@
-/* Uses select and gettimeofday to perform sleeping of sub-second intervals */
+/* Uses nanosleep and CLOCK_MONOTONIC to perform sleeping of sub-second intervals.
+   Time is kept internally in integer nanoseconds since finesleep_initialize();
+   finesleep_time_ns() returns it as is, and finesleep_time() in seconds.
 
-void *finesleep_initialize(int cheat);
+   With FINESLEEP_CHEAT set, time is virtual: a clock thread advances it to the
+   earliest pending deadline as soon as every thread in the simulation is
+   asleep, or blocked in finesleep_cond_wait().  For that to work, the
+   clock has to know about the threads: the thread that calls
+   finesleep_initialize() is counted, and any other thread that takes part
+   must be announced with finesleep_thread_add() (by its creator, before
+   pthread_create()) and must call finesleep_thread_exit() when it is
+   finished.  In between, it may only wait in the procedures below: time
+   doesn't move while it runs, however long that takes, so a thread that
+   blocks anywhere else (say, on a mutex held by a thread that is asleep)
+   stops the clock.
+
+   Every sleep records how late it woke up (in simulated time) in a
+   histogram, and finesleep_report() prints its percentiles.  In virtual
+   time this is 0 by construction. */
+
+#ifndef _FINESLEEP_H_
+#define _FINESLEEP_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define FINESLEEP_CHEAT 1   /* Virtual time (for compatibility, finesleep_initialize(1) still works) */
+#define FINESLEEP_WHEEL 2   /* Keep pending deadlines in a timing wheel instead of a red-black tree */
+
+void *finesleep_initialize(int flags);
+
+/* Without FINESLEEP_CHEAT, this runs the clock speed times faster than real
+   time: finesleep_sleep(fs, 10.0) with a speed of 100 takes 0.1 seconds. */
+
+void *finesleep_initialize_speed(int flags, double speed);
+void finesleep_thread_add(void *fs);
+void finesleep_thread_exit(void *fs);
 void finesleep_sleep(void *fs, double time);
+
+/* These sleep until an absolute time, as returned by finesleep_time() or
+   finesleep_time_ns().  Computing a series of deadlines from one starting
+   time keeps delays between the sleeps from adding up.  If the time has
+   already passed, no simulated time goes by. */
+
+void finesleep_sleep_until(void *fs, double time);
+void finesleep_sleep_until_ns(void *fs, long long time);
+
+/* Condition variables that the clock knows about.  Use them instead of
+   pthread_cond_wait() etc. in simulation threads: a thread blocked in
+   finesleep_cond_wait() counts as idle, so virtual time can move on while
+   it waits, and the timeout of finesleep_cond_timedwait() is in simulated
+   seconds.  Every wait on and signal of a given pthread_cond_t must go
+   through these.  The timed wait returns 0 if signalled and ETIMEDOUT if
+   it timed out.  Unlike pthread_cond_wait(), there are no spurious
+   wakeups. */
+
+void finesleep_cond_wait(void *fs, pthread_cond_t *c, pthread_mutex_t *m);
+int finesleep_cond_timedwait(void *fs, pthread_cond_t *c, pthread_mutex_t *m, double timeout);
+void finesleep_cond_signal(void *fs, pthread_cond_t *c);
+void finesleep_cond_broadcast(void *fs, pthread_cond_t *c);
+
 double finesleep_time(void *fs);
+long long finesleep_time_ns(void *fs);
+void finesleep_report(void *fs, FILE *f);
+
+/* Ends a simulation without ending the process: every thread that is, or
+   later gets, asleep or blocked on this clock calls pthread_exit()
+   (having released the mutex of a cond wait) instead of returning.  It
+   returns 1 if all of them are gone, apart from the caller, and 0 if
+   some never came back within a second -- in which case, don't free
+   anything that they might still be using.  After it, call only
+   finesleep_free(). */
+
+int finesleep_halt(void *fs);
 void finesleep_free(void *a);
 
+#endif
@@ -0,0 +1,120 @@
+/* histogram.c
+   Log-bucketed histograms.  See histogram.h.
+
+   Values below HIST_SUB get a bucket each.  Above that, a value whose
+   highest set bit is bit e goes into one of HIST_SUB buckets for that
+   power of two, chosen by the HIST_SUB_BITS bits below bit e.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "histogram.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_NBUCKETS (HIST_SUB + (63 - HIST_SUB_BITS) * HIST_SUB)
+
+struct histogram {
+  long long count;
+  long long sum;
+  long long max;
+  long long buckets[HIST_NBUCKETS];
+};
+
+static int hist_bucket(long long v)
+{
+  int e;
+
+  if (v < HIST_SUB) return v;
+  e = 63 - __builtin_clzll(v);
+  return HIST_SUB + (e - HIST_SUB_BITS) * HIST_SUB + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB-1));
+}
+
+static long long hist_bucket_top(int b)    /* Largest value in bucket b */
+{
+  int e;
+  long long sub;
+
+  if (b < HIST_SUB) return b;
+  e = (b - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+  sub = (b - HIST_SUB) % HIST_SUB;
+  return (1LL << e) + ((sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+Histogram new_histogram()
+{
+  Histogram h;
+  int i;
+
+  h = talloc(struct histogram, 1);
+  h->count = 0;
+  h->sum = 0;
+  h->max = 0;
+  for (i = 0; i < HIST_NBUCKETS; i++) h->buckets[i] = 0;
+  return h;
+}
+
+void free_histogram(Histogram h)
+{
+  free(h);
+}
+
+void hist_add(Histogram h, long long v)
+{
+  long long max;
+
+  if (v < 0) v = 0;
+  __atomic_fetch_add(&h->buckets[hist_bucket(v)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+  max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+}
+
+long long hist_count(Histogram h)
+{
+  return __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+}
+
+long long hist_max(Histogram h)
+{
+  return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+double hist_mean(Histogram h)
+{
+  long long n;
+
+  n = hist_count(h);
+  if (n == 0) return 0;
+  return (double) __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / n;
+}
+
+long long hist_percentile(Histogram h, double p)
+{
+  long long n, want, seen, top;
+  int b;
+
+  n = hist_count(h);
+  if (n == 0) return 0;
+  want = (long long) (n * p / 100.0 + 0.5);
+  if (want < 1) want = 1;
+  seen = 0;
+  for (b = 0; b < HIST_NBUCKETS; b++) {
+    seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+    if (seen >= want) break;
+  }
+  top = hist_bucket_top(b);
+  if (top > hist_max(h)) top = hist_max(h);
+  return top;
+}
+
+void hist_print(Histogram h, FILE *f, char *name, double scale, char *units)
+{
+  fprintf(f, "%s: %lld samples, mean %.3lf, p50 %.3lf, p90 %.3lf, p99 %.3lf, max %.3lf %s\n",
+          name, hist_count(h), hist_mean(h) / scale,
+          hist_percentile(h, 50) / scale, hist_percentile(h, 90) / scale,
+          hist_percentile(h, 99) / scale, hist_max(h) / scale, units);
+}
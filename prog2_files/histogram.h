@@ -0,0 +1,29 @@
+/* histogram.h
+   Log-bucketed histograms of non-negative long longs (typically latencies
+   in nanoseconds).  Each power of two is split into 8 buckets, so a
+   percentile is accurate to within 12.5%.  hist_add() is lock-free and
+   may be called from any number of threads at once.
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdio.h>
+
+typedef struct histogram *Histogram;
+
+extern Histogram new_histogram();
+extern void free_histogram(Histogram h);
+
+extern void hist_add(Histogram h, long long v);      /* Negative values count as 0 */
+extern long long hist_count(Histogram h);
+extern long long hist_max(Histogram h);
+extern double hist_mean(Histogram h);
+extern long long hist_percentile(Histogram h, double p);   /* p is in [0,100] */
+
+/* Prints "name: n samples, p50 ..., p99 ..., max ..." on one line, with the
+   values divided by scale and labeled with units (e.g. 1000000.0 and "ms"). */
+
+extern void hist_print(Histogram h, FILE *f, char *name, double scale, char *units);
+
+#endif
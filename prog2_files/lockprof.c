@@ -0,0 +1,303 @@
+/* lockprof.c
+   Lock profiler.  See lockprof.h.
+
+   Mutexes are found by address in an open-addressing hash table, which
+   is read without locks: an entry's key is only ever set once, after the
+   rest of the entry, so a reader that sees the key sees the entry.
+   Registration is rare, and takes Reg.  Forgetting a mutex just clears
+   its class, so that probe chains stay intact; if the address is used for
+   another mutex later, the entry is reused.  Since the class can change
+   under a reader, it is stored and loaded atomically, and read once.
+
+   The time a mutex was acquired is kept in its entry.  Only the holder
+   writes it, and only the holder reads it, when it lets go.
+
+   The counts go straight into the class totals with atomic adds.  That
+   costs more than a per-thread tally, but it's only paid when profiling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "finesleep.h"
+#include "lockprof.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+#define LP_BITS 18                  /* The table holds 2^LP_BITS mutexes */
+#define LP_SIZE (1 << LP_BITS)
+#define LP_CLASSES 16
+
+typedef struct {
+  char *name;
+  long long acquires;
+  long long contended;              /* Acquisitions that had to wait */
+  long long wait;                   /* Total ns spent waiting */
+  long long wait_max;
+  long long hold;                   /* Total ns held */
+  long long hold_max;
+} Lock_Class;
+
+typedef struct {
+  pthread_mutex_t *m;
+  int cls;                          /* Index into Classes, or -1 once forgotten */
+  long long acquired;               /* When the holder got it */
+} Lock_Entry;
+
+static int Enabled = 0;
+static Lock_Entry *Table;
+static int NEntries;
+static Lock_Class Classes[LP_CLASSES];
+static int NClasses;
+static long long Untracked;         /* Acquisitions of mutexes that didn't fit in the table */
+static pthread_mutex_t Reg = PTHREAD_MUTEX_INITIALIZER;
+static int Signo;
+
+static long long now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add(long long *p, long long v)
+{
+  __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+static void add_max(long long *p, long long v)
+{
+  long long old;
+
+  old = __atomic_load_n(p, __ATOMIC_RELAXED);
+  while (v > old && !__atomic_compare_exchange_n(p, &old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+}
+
+static Lock_Entry *find(pthread_mutex_t *m)
+{
+  unsigned long long i;
+  pthread_mutex_t *key;
+
+  i = ((unsigned long long) m >> 4) * 0x9e3779b97f4a7c15ULL >> (64 - LP_BITS);
+  while (1) {
+    key = __atomic_load_n(&Table[i].m, __ATOMIC_ACQUIRE);
+    if (key == m) return &Table[i];
+    if (key == NULL) return NULL;
+    i = (i + 1) & (LP_SIZE - 1);
+  }
+}
+
+/* These two must be called with Reg held. */
+
+static int class_index(char *name)
+{
+  int i;
+
+  for (i = 0; i < NClasses; i++) if (strcmp(Classes[i].name, name) == 0) return i;
+  if (NClasses == LP_CLASSES) return 0;
+  memset(&Classes[NClasses], 0, sizeof(Lock_Class));
+  Classes[NClasses].name = name;
+  return NClasses++;
+}
+
+static Lock_Entry *insert(pthread_mutex_t *m, int cls)
+{
+  unsigned long long i;
+  Lock_Entry *e;
+
+  e = find(m);
+  if (e != NULL) {
+    __atomic_store_n(&e->cls, cls, __ATOMIC_RELAXED);
+    return e;
+  }
+  if (NEntries >= LP_SIZE / 4 * 3) return NULL;
+  i = ((unsigned long long) m >> 4) * 0x9e3779b97f4a7c15ULL >> (64 - LP_BITS);
+  while (Table[i].m != NULL) i = (i + 1) & (LP_SIZE - 1);
+  Table[i].cls = cls;
+  Table[i].acquired = 0;
+  __atomic_store_n(&Table[i].m, m, __ATOMIC_RELEASE);
+  NEntries++;
+  return &Table[i];
+}
+
+static void *reporter(void *arg)
+{
+  sigset_t set;
+  int sig;
+
+  sigemptyset(&set);
+  sigaddset(&set, Signo);
+  while (1) {
+    if (sigwait(&set, &sig) == 0) lockprof_report(stderr);
+  }
+  return NULL;
+}
+
+void lockprof_enable(int signo)
+{
+  sigset_t set;
+  pthread_t tid;
+
+  Table = (Lock_Entry *) calloc(LP_SIZE, sizeof(Lock_Entry));
+  if (Table == NULL) {
+    fprintf(stderr, "lockprof: out of memory\n");
+    exit(1);
+  }
+  NEntries = 0;
+  NClasses = 0;
+  class_index("other");
+  Untracked = 0;
+  Enabled = 1;
+
+  if (signo == 0) return;
+  Signo = signo;
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  if (pthread_create(&tid, NULL, reporter, NULL) != 0) {
+    perror("lockprof: pthread_create");
+    exit(1);
+  }
+  pthread_detach(tid);
+}
+
+int lockprof_enabled()
+{
+  return Enabled;
+}
+
+void lockprof_register(pthread_mutex_t *m, char *cls)
+{
+  if (!Enabled) return;
+  pthread_mutex_lock(&Reg);
+  insert(m, class_index(cls));
+  pthread_mutex_unlock(&Reg);
+}
+
+void lockprof_forget(pthread_mutex_t *m)
+{
+  Lock_Entry *e;
+
+  if (!Enabled) return;
+  e = find(m);
+  if (e != NULL) __atomic_store_n(&e->cls, -1, __ATOMIC_RELAXED);
+}
+
+/* Starts m's hold time, once it is held.  Mutexes that nobody registered
+   go into "other". */
+
+static void got(pthread_mutex_t *m, long long t, long long wait)
+{
+  Lock_Entry *e;
+  Lock_Class *c;
+  int cls;
+
+  e = find(m);
+  cls = (e == NULL) ? -1 : __atomic_load_n(&e->cls, __ATOMIC_RELAXED);
+  if (cls < 0) {
+    pthread_mutex_lock(&Reg);
+    e = insert(m, 0);
+    pthread_mutex_unlock(&Reg);
+    if (e == NULL) {
+      add(&Untracked, 1);
+      return;
+    }
+    cls = 0;
+  }
+  c = &Classes[cls];
+  add(&c->acquires, 1);
+  if (wait > 0) {
+    add(&c->contended, 1);
+    add(&c->wait, wait);
+    add_max(&c->wait_max, wait);
+  }
+  e->acquired = t;
+}
+
+static void letting_go(pthread_mutex_t *m)
+{
+  Lock_Entry *e;
+  Lock_Class *c;
+  long long hold;
+  int cls;
+
+  e = find(m);
+  if (e == NULL) return;
+  cls = __atomic_load_n(&e->cls, __ATOMIC_RELAXED);
+  if (cls < 0) return;
+  c = &Classes[cls];
+  hold = now() - e->acquired;
+  add(&c->hold, hold);
+  add_max(&c->hold_max, hold);
+}
+
+int lockprof_lock(pthread_mutex_t *m)
+{
+  long long start, t;
+  int rv;
+
+  if (!Enabled) return pthread_mutex_lock(m);
+  if (pthread_mutex_trylock(m) == 0) {
+    got(m, now(), 0);
+    return 0;
+  }
+  start = now();
+  rv = pthread_mutex_lock(m);
+  if (rv != 0) return rv;
+  t = now();
+  got(m, t, (t > start) ? t - start : 1);
+  return 0;
+}
+
+int lockprof_unlock(pthread_mutex_t *m)
+{
+  if (Enabled) letting_go(m);
+  return pthread_mutex_unlock(m);
+}
+
+void lockprof_cond_wait(void *fs, pthread_cond_t *c, pthread_mutex_t *m)
+{
+  if (Enabled) letting_go(m);
+  finesleep_cond_wait(fs, c, m);
+  if (Enabled) got(m, now(), 0);
+}
+
+int lockprof_cond_timedwait(void *fs, pthread_cond_t *c, pthread_mutex_t *m, double timeout)
+{
+  int rv;
+
+  if (Enabled) letting_go(m);
+  rv = finesleep_cond_timedwait(fs, c, m, timeout);
+  if (Enabled) got(m, now(), 0);
+  return rv;
+}
+
+void lockprof_report(FILE *f)
+{
+  Lock_Class *c;
+  long long acquires, contended, hold;
+  int i, n;
+
+  n = __atomic_load_n(&NClasses, __ATOMIC_ACQUIRE);
+  fprintf(f, "%-10s %12s %10s %12s %10s %12s %10s %10s\n", "Lock", "Acquires", "Contended",
+          "Wait ms", "Max us", "Hold ms", "Mean us", "Max us");
+  for (i = 0; i < n; i++) {
+    c = &Classes[i];
+    acquires = __atomic_load_n(&c->acquires, __ATOMIC_RELAXED);
+    if (acquires == 0) continue;
+    contended = __atomic_load_n(&c->contended, __ATOMIC_RELAXED);
+    hold = __atomic_load_n(&c->hold, __ATOMIC_RELAXED);
+    fprintf(f, "%-10s %12lld %9.2lf%% %12.3lf %10.1lf %12.3lf %10.3lf %10.1lf\n", c->name,
+            acquires, 100.0 * contended / acquires,
+            __atomic_load_n(&c->wait, __ATOMIC_RELAXED) / 1000000.0,
+            __atomic_load_n(&c->wait_max, __ATOMIC_RELAXED) / 1000.0,
+            hold / 1000000.0, hold / 1000.0 / acquires,
+            __atomic_load_n(&c->hold_max, __ATOMIC_RELAXED) / 1000.0);
+  }
+  if (Untracked > 0) fprintf(f, "%lld acquisitions of mutexes that didn't fit in the table\n", Untracked);
+  fflush(f);
+}
@@ -0,0 +1,42 @@
+/* lockprof.h
+   An opt-in lock profiler.  elevator.h turns every pthread_mutex_lock(),
+   pthread_mutex_unlock() and finesleep_cond_wait() in the skeleton and in
+   your code into calls to the procedures below.  Until lockprof_enable()
+   is called, they just pass the calls on.  After that, the acquisitions
+   of each mutex, the time spent waiting for it and the time it is held
+   are added up by class -- es->lock, e->lock, p->lock and so on.  A mutex
+   gets its class from lockprof_register(); unregistered ones are "other".
+
+   The times are real time, not simulated time, since what we want to
+   know is what the locks cost the simulator.  A mutex's hold time stops
+   while its holder waits on a condition variable, and starts again when
+   the holder gets it back.
+
+   Profiling slows the threads down, but in virtual time it doesn't change
+   the simulation: the clock doesn't move while any of them is running, so
+   -k prints the same events at the same times as a run without it (though
+   events of the same instant may come out in another order).
+
+   lockprof_enable(signo) must be called before any other thread is
+   created.  If signo isn't 0, that signal is blocked, and a thread prints
+   the report on stderr whenever it arrives (e.g. kill -USR1).
+ */
+
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+extern void lockprof_enable(int signo);
+extern int lockprof_enabled();
+extern void lockprof_register(pthread_mutex_t *m, char *cls);   /* cls must stay around */
+extern void lockprof_forget(pthread_mutex_t *m);                 /* Before destroying m */
+extern void lockprof_report(FILE *f);
+
+extern int lockprof_lock(pthread_mutex_t *m);
+extern int lockprof_unlock(pthread_mutex_t *m);
+extern void lockprof_cond_wait(void *fs, pthread_cond_t *c, pthread_mutex_t *m);
+extern int lockprof_cond_timedwait(void *fs, pthread_cond_t *c, pthread_mutex_t *m, double timeout);
+
+#endif
@@ -0,0 +1,86 @@
+/* rng.c
+   xoshiro256** and its jump function, after the public domain reference
+   code by David Blackman and Sebastiano Vigna.  See rng.h.
+ */
+
+#include "rng.h"
+
+static unsigned long long rotl(unsigned long long x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static unsigned long long splitmix64(unsigned long long *x)
+{
+  unsigned long long z;
+
+  z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+unsigned long long rng_next(Rng *r)
+{
+  unsigned long long result, t;
+
+  result = rotl(r->s[1] * 5, 7) * 9;
+  t = r->s[1] << 17;
+  r->s[2] ^= r->s[0];
+  r->s[3] ^= r->s[1];
+  r->s[1] ^= r->s[2];
+  r->s[0] ^= r->s[3];
+  r->s[2] ^= t;
+  r->s[3] = rotl(r->s[3], 45);
+  return result;
+}
+
+/* Equivalent to 2^128 calls to rng_next(). */
+
+static void rng_jump(Rng *r)
+{
+  static const unsigned long long JUMP[4] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                              0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+  unsigned long long s0, s1, s2, s3;
+  int i, b;
+
+  s0 = s1 = s2 = s3 = 0;
+  for (i = 0; i < 4; i++) {
+    for (b = 0; b < 64; b++) {
+      if (JUMP[i] & (1ULL << b)) {
+        s0 ^= r->s[0];
+        s1 ^= r->s[1];
+        s2 ^= r->s[2];
+        s3 ^= r->s[3];
+      }
+      rng_next(r);
+    }
+  }
+  r->s[0] = s0;
+  r->s[1] = s1;
+  r->s[2] = s2;
+  r->s[3] = s3;
+}
+
+void rng_seed(Rng *r, long long seed, int stream)
+{
+  unsigned long long x;
+  int i;
+
+  x = (unsigned long long) seed;
+  for (i = 0; i < 4; i++) r->s[i] = splitmix64(&x);
+  for (i = 0; i < stream; i++) rng_jump(r);
+}
+
+double rng_double(Rng *r)
+{
+  return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Multiply-and-shift rather than %, which is slower.  The bias is at
+   most n / 2^32. */
+
+long rng_int(Rng *r, long n)
+{
+  return (long) (((rng_next(r) >> 32) * (unsigned long long) n) >> 32);
+}
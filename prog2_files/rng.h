@@ -0,0 +1,24 @@
+/* rng.h
+   Pseudo-random numbers with xoshiro256** (Blackman and Vigna).  Each
+   Rng is its own stream, with no shared state, so several simulations
+   (or several threads of one) can draw numbers without locks and without
+   disturbing each other's sequences.
+
+   rng_seed(r, seed, stream) seeds r from seed with splitmix64, and then
+   jumps it ahead stream * 2^128 steps, so the streams of one seed never
+   overlap.  The same seed and stream always give the same numbers.
+ */
+
+#ifndef _RNG_H_
+#define _RNG_H_
+
+typedef struct {
+  unsigned long long s[4];
+} Rng;
+
+extern void rng_seed(Rng *r, long long seed, int stream);
+extern unsigned long long rng_next(Rng *r);
+extern double rng_double(Rng *r);          /* Uniform in [0,1) */
+extern long rng_int(Rng *r, long n);       /* Uniform in [0,n), for 0 < n < 2^32 */
+
+#endif
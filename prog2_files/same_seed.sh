@@ -0,0 +1,51 @@
+#!/bin/sh
+
+# Runs two commands, the first on its own and the second with a busy loop
+# for every core (and two more) running, and compares the parts of their
+# output that match pattern (an egrep pattern) -- by default, the arrivals
+# and the number of people started.  In virtual time, the seed fixes
+# those, however busy the machine is, so this should print "Same".  For example:
+#
+#   sh same_seed.sh './elevator_part2 100 25 .02 .2 .01 12 3' './elevator_part2 100 25 .02 .2 .01 12 3'
+#
+# Or, to check that running simulations side by side doesn't change them
+# (with a solution whose elevators don't race each other, like part 1):
+#
+#   sh same_seed.sh './elevator_part1 -m runs.txt -j 1' './elevator_part1 -m runs.txt -j 8' '.*Started.*'
+
+if [ $# -lt 2 -o $# -gt 3 ]; then
+  echo "usage: sh same_seed.sh 'command 1' 'command 2' [pattern]" >&2
+  exit 1
+fi
+
+pattern=${3:-'.*wanting to go.*|[0-9]+ Started'}
+out1=/tmp/same_seed1.$$
+out2=/tmp/same_seed2.$$
+
+$1 2>/dev/null | grep -oE "$pattern" > $out1
+
+n=`nproc 2>/dev/null || echo 1`
+n=`echo $n | awk '{ print $1+2 }'`
+pids=""
+i=0
+while [ $i -lt $n ]; do
+  sh -c 'while :; do :; done' &
+  pids="$pids $!"
+  i=`echo $i | awk '{ print $1+1 }'`
+done
+$2 2>/dev/null | grep -oE "$pattern" > $out2
+kill $pids
+
+status=0
+if [ ! -s $out1 ]; then
+  echo "No lines match $pattern" >&2
+  status=1
+elif cmp -s $out1 $out2; then
+  echo "Same: `wc -l < $out1` lines"
+else
+  echo "Different:"
+  diff $out1 $out2 | head -n 10
+  status=1
+fi
+rm -f $out1 $out2
+exit $status
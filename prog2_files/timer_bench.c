@@ -0,0 +1,174 @@
+/* timer_bench.c
+   Compares the two timer stores that finesleep can use: a red-black tree
+   (jrb) and the hierarchical timing wheel (timewheel).
+
+   It runs the "hold" model: npending timers are inserted, and then, nops
+   times, the earliest timer is removed and a new one is inserted at that
+   time plus an exponential increment with the given mean (in seconds).
+   Every cancel_every'th operation also deletes and re-inserts a random
+   pending timer, as a cancelled timed wait would.
+
+   If quantum (in seconds) is given, deadlines are rounded up to a
+   multiple of it, so that many timers share each deadline, as they do in
+   the simulator, where people and elevators wake at the same instants.
+
+   With cancel_every set to 0, both stores must pop exactly the same
+   sequence of deadlines, so the last ones are compared as a sanity check.
+   (With cancellations, two timers that tie may be popped in a different
+   order, and the random victims then differ.)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "jrb.h"
+#include "timewheel.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+typedef struct {
+  TW_Timer t;
+  JRB node;
+} Timer;
+
+long long now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long Quantum = 0;             /* In ns, or 0 for none */
+
+long long next_deadline(long long now, double mean)
+{
+  long long d;
+
+  d = now + (long long) (-1.0 * log(1.0 - drand48()) * mean * 1000000000.0);
+  if (Quantum > 0) d = (d + Quantum - 1) / Quantum * Quantum;
+  return d;
+}
+
+int cmp_ns(Jval a, Jval b)
+{
+  if (a.l < b.l) return -1;
+  if (a.l > b.l) return 1;
+  return 0;
+}
+
+/* The tree allocates a node per insertion, just as finesleep's tree does. */
+
+double bench_jrb(Timer *timers, int npending, int nops, int cancel_every, double mean, long long *last)
+{
+  JRB tree, ptr;
+  Timer *t;
+  Jval k;
+  long long start, now;
+  int i;
+
+  tree = make_jrb();
+  for (i = 0; i < npending; i++) {
+    k.l = next_deadline(0, mean);
+    timers[i].node = jrb_insert_gen(tree, k, new_jval_v((void *) &timers[i]), cmp_ns);
+  }
+
+  start = now_ns();
+  now = 0;
+  for (i = 0; i < nops; i++) {
+    ptr = jrb_first(tree);
+    now = ptr->key.l;
+    t = (Timer *) ptr->val.v;
+    jrb_delete_node(ptr);
+    k.l = next_deadline(now, mean);
+    t->node = jrb_insert_gen(tree, k, new_jval_v((void *) t), cmp_ns);
+    if (cancel_every > 0 && i % cancel_every == 0) {
+      t = &timers[lrand48() % npending];
+      jrb_delete_node(t->node);
+      k.l = next_deadline(now, mean);
+      t->node = jrb_insert_gen(tree, k, new_jval_v((void *) t), cmp_ns);
+    }
+  }
+  *last = now;
+  start = now_ns() - start;
+  jrb_free_tree(tree);
+  return (double) start / nops;
+}
+
+double bench_wheel(Timer *timers, int npending, int nops, int cancel_every, double mean, long long *last)
+{
+  Timewheel tw;
+  Timer *t;
+  TW_Timer *first;
+  long long start, now;
+  int i;
+
+  tw = new_timewheel(0);
+  for (i = 0; i < npending; i++) {
+    timers[i].t.deadline = next_deadline(0, mean);
+    timers[i].t.v = (void *) &timers[i];
+    tw_insert(tw, &timers[i].t);
+  }
+
+  start = now_ns();
+  now = 0;
+  for (i = 0; i < nops; i++) {
+    first = tw_first(tw);
+    now = first->deadline;
+    t = (Timer *) first->v;
+    tw_delete(tw, first);
+    t->t.deadline = next_deadline(now, mean);
+    tw_insert(tw, &t->t);
+    if (cancel_every > 0 && i % cancel_every == 0) {
+      t = &timers[lrand48() % npending];
+      tw_delete(tw, &t->t);
+      t->t.deadline = next_deadline(now, mean);
+      tw_insert(tw, &t->t);
+    }
+  }
+  *last = now;
+  start = now_ns() - start;
+  free_timewheel(tw);
+  return (double) start / nops;
+}
+
+main(int argc, char **argv)
+{
+  int npending, nops, cancel_every;
+  double mean, quantum, jrb_ns, wheel_ns;
+  long seed;
+  long long jrb_last, wheel_last;
+  Timer *timers;
+
+  quantum = 0;
+  if (argc < 6 || argc > 7 ||
+      sscanf(argv[1], "%d", &npending) != 1 || npending <= 0 ||
+      sscanf(argv[2], "%d", &nops) != 1 || nops <= 0 ||
+      sscanf(argv[3], "%lf", &mean) != 1 || mean <= 0 ||
+      sscanf(argv[4], "%d", &cancel_every) != 1 ||
+      sscanf(argv[5], "%ld", &seed) != 1 ||
+      (argc == 7 && (sscanf(argv[6], "%lf", &quantum) != 1 || quantum < 0))) {
+    fprintf(stderr, "usage: timer_bench npending nops mean-interval cancel-every seed [quantum]\n");
+    exit(1);
+  }
+
+  Quantum = (long long) (quantum * 1000000000.0 + 0.5);
+  timers = talloc(Timer, npending);
+
+  srand48(seed);
+  jrb_ns = bench_jrb(timers, npending, nops, cancel_every, mean, &jrb_last);
+  srand48(seed);
+  wheel_ns = bench_wheel(timers, npending, nops, cancel_every, mean, &wheel_last);
+
+  printf("%d pending, %d ops, mean interval %.6lf s", npending, nops, mean);
+  if (Quantum > 0) printf(", deadlines in steps of %.6lf s", quantum);
+  printf("\n");
+  printf("  jrb:   %8.1lf ns/op\n", jrb_ns);
+  printf("  wheel: %8.1lf ns/op\n", wheel_ns);
+  if (cancel_every == 0 && jrb_last != wheel_last) {
+    printf("Error: the stores disagree -- last deadline %lld vs %lld\n", jrb_last, wheel_last);
+    exit(1);
+  }
+  exit(0);
+}
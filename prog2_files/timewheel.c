@@ -0,0 +1,204 @@
+/* timewheel.c
+   Hierarchical timing wheel.  See timewheel.h.
+
+   Time is measured in ticks of 2^TW_TICK nanoseconds.  The tick is 1 ns,
+   so every timer in a level-0 slot has the same deadline, and the first
+   one in the slot is the earliest (and the first inserted).  Level l has
+   TW_SLOTS slots, each covering TW_SLOTS^l ticks.  A timer goes on the
+   level of the highest base-TW_SLOTS digit in which its tick differs from
+   the wheel's current tick, so level 0 holds the timers due in the current
+   TW_SLOTS ticks, level 1 those due in the current TW_SLOTS^2, and so on.
+   Anything further out than the top level goes on an unsorted overflow
+   list.  A bitmap per level says which slots are non-empty.
+
+   Finding the earliest timer looks at level 0 first.  If it is empty,
+   the earliest non-empty slot on the lowest non-empty level holds the
+   soonest timers, so the wheel moves up to the start of that slot and
+   spreads its timers out over the lower levels.  Each timer can only be
+   moved down TW_LEVELS times, so this is O(1) amortized, however many
+   timers share a deadline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "timewheel.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+#define TW_TICK 0                  /* A tick is 1 ns */
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 8                /* 2^48 ticks -- about 78 hours */
+#define TW_OVERFLOW TW_LEVELS
+
+struct timewheel {
+  long long cur;                             /* Current tick */
+  int n;                                     /* Number of timers */
+  unsigned long long pending[TW_LEVELS];     /* Bit s set if slot s is non-empty */
+  TW_Timer slots[TW_LEVELS][TW_SLOTS];       /* Sentinels of circular lists */
+  TW_Timer overflow;
+};
+
+static void tw_link(TW_Timer *head, TW_Timer *t)    /* Appends t to head's list */
+{
+  t->next = head;
+  t->prev = head->prev;
+  t->next->prev = t;
+  t->prev->next = t;
+}
+
+static void tw_unlink(TW_Timer *t)
+{
+  t->next->prev = t->prev;
+  t->prev->next = t->next;
+}
+
+static void tw_place(Timewheel tw, TW_Timer *t)
+{
+  long long tick, diff;
+  int level;
+
+  tick = t->deadline >> TW_TICK;
+  if (tick < tw->cur) tick = tw->cur;
+  diff = tick ^ tw->cur;
+  level = 0;
+  while (level < TW_LEVELS && (diff >> ((level+1) * TW_BITS)) != 0) level++;
+
+  if (level == TW_LEVELS) {
+    t->level = TW_OVERFLOW;
+    t->slot = 0;
+    tw_link(&tw->overflow, t);
+    return;
+  }
+  t->level = level;
+  t->slot = (tick >> (level * TW_BITS)) & (TW_SLOTS-1);
+  tw_link(&tw->slots[level][t->slot], t);
+  tw->pending[level] |= (1ULL << t->slot);
+}
+
+/* Moves the wheel to tick and re-places every timer on the list head. */
+
+static void tw_cascade(Timewheel tw, TW_Timer *head, long long tick)
+{
+  TW_Timer *t, tmp;
+
+  /* Move the list off head first -- overflow timers may go back on it. */
+
+  tmp.next = head->next;
+  tmp.prev = head->prev;
+  tmp.next->prev = &tmp;
+  tmp.prev->next = &tmp;
+  head->next = head;
+  head->prev = head;
+
+  tw->cur = tick;
+  while (tmp.next != &tmp) {
+    t = tmp.next;
+    tw_unlink(t);
+    tw_place(tw, t);
+  }
+}
+
+Timewheel new_timewheel(long long now)
+{
+  Timewheel tw;
+  int l, s;
+
+  tw = talloc(struct timewheel, 1);
+  tw->cur = now >> TW_TICK;
+  tw->n = 0;
+  for (l = 0; l < TW_LEVELS; l++) {
+    tw->pending[l] = 0;
+    for (s = 0; s < TW_SLOTS; s++) {
+      tw->slots[l][s].next = &tw->slots[l][s];
+      tw->slots[l][s].prev = &tw->slots[l][s];
+    }
+  }
+  tw->overflow.next = &tw->overflow;
+  tw->overflow.prev = &tw->overflow;
+  return tw;
+}
+
+void free_timewheel(Timewheel tw)
+{
+  free(tw);
+}
+
+void tw_insert(Timewheel tw, TW_Timer *t)
+{
+  tw_place(tw, t);
+  tw->n++;
+}
+
+void tw_delete(Timewheel tw, TW_Timer *t)
+{
+  TW_Timer *head;
+
+  tw_unlink(t);
+  tw->n--;
+  if (t->level == TW_OVERFLOW) return;
+  head = &tw->slots[t->level][t->slot];
+  if (head->next == head) tw->pending[t->level] &= ~(1ULL << t->slot);
+}
+
+int tw_empty(Timewheel tw)
+{
+  return (tw->n == 0);
+}
+
+/* The wheel is never moved past deadline, so that a caller can look for
+   more timers due at the current time without moving time on. */
+
+TW_Timer *tw_first_by(Timewheel tw, long long deadline)
+{
+  unsigned long long mask;
+  int level, digit, slot, shift;
+  long long tick;
+  TW_Timer *t, *best;
+
+  if (tw->n == 0) return NULL;
+
+  while (1) {
+
+    /* Level 0 has no slots before the current tick, so its first
+       non-empty slot holds the earliest timers, which all share a
+       deadline. */
+
+    digit = tw->cur & (TW_SLOTS-1);
+    mask = tw->pending[0] & (~0ULL << digit);
+    if (mask != 0) {
+      t = tw->slots[0][__builtin_ctzll(mask)].next;
+      return (t->deadline <= deadline) ? t : NULL;
+    }
+
+    /* Otherwise, cascade the earliest slot of the lowest non-empty level. */
+
+    for (level = 1; level < TW_LEVELS; level++) {
+      shift = level * TW_BITS;
+      digit = (tw->cur >> shift) & (TW_SLOTS-1);
+      mask = (digit == TW_SLOTS-1) ? 0 : tw->pending[level] & (~0ULL << (digit+1));
+      if (mask != 0) break;
+    }
+
+    if (level < TW_LEVELS) {
+      slot = __builtin_ctzll(mask);
+      tick = ((tw->cur >> (shift + TW_BITS)) << (shift + TW_BITS)) | ((long long) slot << shift);
+      if (tick > (deadline >> TW_TICK)) return NULL;
+      tw->pending[level] &= ~(1ULL << slot);
+      tw_cascade(tw, &tw->slots[level][slot], tick);
+    } else {
+      best = tw->overflow.next;
+      for (t = best->next; t != &tw->overflow; t = t->next) {
+        if (t->deadline < best->deadline) best = t;
+      }
+      if (best->deadline > deadline) return NULL;
+      tw_cascade(tw, &tw->overflow, best->deadline >> TW_TICK);
+    }
+  }
+}
+
+TW_Timer *tw_first(Timewheel tw)
+{
+  return tw_first_by(tw, LLONG_MAX);
+}
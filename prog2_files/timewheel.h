@@ -0,0 +1,42 @@
+/* timewheel.h
+   A hierarchical timing wheel: a priority queue of timers keyed by a
+   long long deadline (nanoseconds), with O(1) insert and delete, and
+   O(1) amortized removal of the earliest timer, however many timers share
+   a deadline.  Timers with the same deadline come out in the order in
+   which they went in.
+
+   Timers are intrusive -- the caller owns the TW_Timer, so nothing is
+   malloc'd per insertion.  Set the deadline and v fields, then insert it.
+
+   Time only goes forward: tw_first() moves the wheel up to the timer
+   that it returns, so after calling it, do not insert a timer whose
+   deadline is earlier than that timer's.  tw_first_by() only returns the
+   earliest timer if it is due by deadline, and never moves the wheel
+   past deadline, so it can look for more timers due at the current time
+   without moving time on.
+ */
+
+#ifndef _TIMEWHEEL_H_
+#define _TIMEWHEEL_H_
+
+typedef struct tw_timer {
+  long long deadline;
+  void *v;                        /* Whatever you want */
+  struct tw_timer *next;          /* The rest is for the wheel */
+  struct tw_timer *prev;
+  int level;
+  int slot;
+} TW_Timer;
+
+typedef struct timewheel *Timewheel;
+
+extern Timewheel new_timewheel(long long now); /* No deadline may be earlier than now */
+extern void free_timewheel(Timewheel tw);      /* Does not touch the timers */
+
+extern void tw_insert(Timewheel tw, TW_Timer *t);
+extern void tw_delete(Timewheel tw, TW_Timer *t);
+extern TW_Timer *tw_first(Timewheel tw);       /* Earliest timer, or NULL.  Does not remove it. */
+extern TW_Timer *tw_first_by(Timewheel tw, long long deadline);   /* Or NULL if it's later */
+extern int tw_empty(Timewheel tw);
+
+#endif
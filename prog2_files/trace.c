@@ -0,0 +1,72 @@
+/* trace.c
+   Printing and reading binary trace records.  See trace.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "names.h"
+#include "trace.h"
+
+static char *Types[TR_NTYPES] = { "moving", "arrives", "opening", "open", "closing", "closed",
+                                  "gets on", "gets off", "person arrives", "done", "over" };
+
+char *trace_type(int type)
+{
+  return (type >= 0 && type < TR_NTYPES) ? Types[type] : "unknown";
+}
+
+char *trace_name(Trace_Record *r, char *buf)
+{
+  sprintf(buf, "%s %s(%d)", FNAMES[r->fname], LNAMES[r->lname], r->person);
+  return buf;
+}
+
+void trace_print(FILE *f, Trace_Record *r)
+{
+  double t;
+
+  t = r->time / 1000000000.0;
+  switch (r->type) {
+    case TR_MOVING:
+      fprintf(f, "%8.3lf: Elevator %02d moving from floor %02d to floor %02d.\n", t, r->elevator, r->floor, r->to);
+      break;
+    case TR_ARRIVES:
+      fprintf(f, "%8.3lf: Elevator %02d arrives at floor %02d.\n", t, r->elevator, r->floor);
+      break;
+    case TR_OPENING:
+      fprintf(f, "%8.3lf: Elevator %02d opening its door.\n", t, r->elevator);
+      break;
+    case TR_OPEN:
+      fprintf(f, "%8.3lf: Elevator %02d door is open.\n", t, r->elevator);
+      break;
+    case TR_CLOSING:
+      fprintf(f, "%8.3lf: Elevator %02d closing its door.\n", t, r->elevator);
+      break;
+    case TR_CLOSED:
+      fprintf(f, "%8.3lf: Elevator %02d door is closed.\n", t, r->elevator);
+      break;
+    case TR_GETS_ON:
+      fprintf(f, "%8.3lf: %s %s(%d) gets on elevator %02d on floor %02d.\n", t,
+              FNAMES[r->fname], LNAMES[r->lname], r->person, r->elevator, r->floor);
+      break;
+    case TR_GETS_OFF:
+      fprintf(f, "%8.3lf: %s %s(%d) gets off elevator %02d on floor %02d.\n", t,
+              FNAMES[r->fname], LNAMES[r->lname], r->person, r->elevator, r->floor);
+      break;
+    case TR_PERSON_ARRIVES:
+      fprintf(f, "%8.3lf: %s %s(%d) arrives at floor %02d wanting to go to floor %02d.\n", t,
+              FNAMES[r->fname], LNAMES[r->lname], r->person, r->floor, r->to);
+      break;
+    case TR_DONE:
+      fprintf(f, "%8.3lf: %s %s(%d) is done.\n", t, FNAMES[r->fname], LNAMES[r->lname], r->person);
+      break;
+    case TR_OVER:
+      fprintf(f, "%8.3lf: Simulation Over. %10d Started.  %10d Finished.\n", t, r->floor, r->to);
+      break;
+  }
+}
+
+int trace_read(FILE *f, Trace_Record *r)
+{
+  return (fread(r, sizeof(Trace_Record), 1, f) == 1);
+}
@@ -0,0 +1,59 @@
+/* trace.h
+   The simulator's events, as fixed-size binary records.  The skeleton
+   logs a Trace_Record for each line of output, and either prints it as
+   the usual text or, with -b, writes the records themselves.
+   trace2text turns a binary trace back into text, and double-check -b
+   checks one directly.
+
+   Records are 32 bytes in the host's byte order, in the order in which
+   they were logged.  In virtual time, that is time order; with -s it is
+   only nearly so -- convert to text and use reorder.
+
+     Type                 Fields used
+     TR_MOVING            elevator, floor (from), to
+     TR_ARRIVES           elevator, floor
+     TR_OPENING ...       elevator
+     TR_GETS_ON/OFF       person, elevator, floor
+     TR_PERSON_ARRIVES    person, floor (from), to
+     TR_DONE              person
+     TR_OVER              floor (people started), to (people finished)
+
+   Every person record has the indices of the person's names in FNAMES
+   and LNAMES (names.h), so it can be printed on its own.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+
+#define TR_MOVING          0
+#define TR_ARRIVES         1
+#define TR_OPENING         2
+#define TR_OPEN            3
+#define TR_CLOSING         4
+#define TR_CLOSED          5
+#define TR_GETS_ON         6
+#define TR_GETS_OFF        7
+#define TR_PERSON_ARRIVES  8
+#define TR_DONE            9
+#define TR_OVER           10
+#define TR_NTYPES         11
+
+typedef struct {
+  long long time;         /* Nanoseconds */
+  int type;
+  int elevator;
+  int person;             /* The person's number -- the n in "lname(n)" */
+  int floor;
+  int to;
+  short fname;            /* Index in FNAMES */
+  short lname;            /* Index in LNAMES */
+} Trace_Record;
+
+extern void trace_print(FILE *f, Trace_Record *r);   /* Prints r as a line of the text output */
+extern char *trace_name(Trace_Record *r, char *buf); /* Puts "fname lname(n)" into buf and returns it */
+extern int trace_read(FILE *f, Trace_Record *r);     /* Returns 0 at the end of the file */
+extern char *trace_type(int type);                   /* A short name for the type, e.g. "moving" */
+
+#endif
@@ -0,0 +1,20 @@
+/* trace2text.c
+   Reads a binary trace (elevator -b) on standard input and prints it as
+   the simulator's usual text output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+main(int argc, char **argv)
+{
+  Trace_Record r;
+
+  if (argc != 1) {
+    fprintf(stderr, "usage: trace2text < binary-trace\n");
+    exit(1);
+  }
+  while (trace_read(stdin, &r)) trace_print(stdout, &r);
+  exit(0);
+}
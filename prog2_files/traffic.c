@@ -0,0 +1,180 @@
+/* traffic.c
+   Traffic profiles.  See traffic.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "traffic.h"
+
+#define talloc(ty, sz) (ty *) malloc ((sz) * sizeof(ty))
+
+/* The default reproduces the original model draw for draw, so it keeps
+   its thresholds of 0.333333 and 0.6666667.  A profile only sets the
+   split, so it leaves any weights or bursts alone. */
+
+void traffic_init(Traffic *t)
+{
+  t->up = 0.333333;
+  t->down = 0.6666667 - 0.333333;
+  t->nfloors = 0;
+  t->cum = NULL;
+  t->burst = 0;
+  t->burst_on = 0;
+  t->burst_off = 0;
+}
+
+int traffic_profile(Traffic *t, char *s)
+{
+  double up, down;
+  char c;
+
+  if (strcmp(s, "uniform") == 0) {
+    up = 0.333333;
+    down = 0.6666667 - 0.333333;
+  } else if (strcmp(s, "up") == 0) {
+    up = 0.85;
+    down = 0.05;
+  } else if (strcmp(s, "down") == 0) {
+    up = 0.05;
+    down = 0.85;
+  } else if (strcmp(s, "lunch") == 0) {
+    up = 0.4;
+    down = 0.4;
+  } else if (sscanf(s, "%lf,%lf%c", &up, &down, &c) != 2) {
+    return 0;
+  }
+  if (up < 0 || down < 0 || up + down > 1) return 0;
+  t->up = up;
+  t->down = down;
+  return 1;
+}
+
+int traffic_weights(Traffic *t, char *s)
+{
+  double w;
+  char *end;
+  int n, size;
+
+  if (t->cum != NULL) free(t->cum);
+  size = 16;
+  t->cum = talloc(double, size);
+  t->cum[0] = 0;
+  n = 0;
+  while (1) {
+    w = strtod(s, &end);
+    if (end == s || w < 0) return 0;
+    n++;
+    if (n == size) {
+      size *= 2;
+      t->cum = (double *) realloc(t->cum, size * sizeof(double));
+    }
+    t->cum[n] = t->cum[n-1] + w;
+    if (*end == '\0') break;
+    if (*end != ',') return 0;
+    s = end + 1;
+  }
+  t->nfloors = n;
+  return 1;
+}
+
+int traffic_bursts(Traffic *t, char *s)
+{
+  char c;
+
+  if (sscanf(s, "%lf,%lf,%lf%c", &t->burst, &t->burst_on, &t->burst_off, &c) != 3) return 0;
+  return (t->burst > 0 && t->burst_on > 0 && t->burst_off > 0);
+}
+
+/* Lobby trips need a weighted floor above the lobby, and interfloor
+   trips need two weighted floors. */
+
+int traffic_check(Traffic *t, int nfloors)
+{
+  int i, above, all;
+
+  if (t->cum == NULL) return 1;
+  if (t->nfloors != nfloors) return 0;
+  above = 0;
+  all = (t->cum[1] > 0);
+  for (i = 2; i <= nfloors; i++) {
+    if (t->cum[i] > t->cum[i-1]) {
+      above++;
+      all++;
+    }
+  }
+  if (t->up + t->down > 0 && above == 0) return 0;
+  if (t->up + t->down < 1 && all < 2) return 0;
+  return 1;
+}
+
+static double expo(Rng *r, double mean)
+{
+  return -1.0 * log(1.0 - rng_double(r)) * mean;
+}
+
+void traffic_start(Traffic *t, Traffic_State *ts, Rng *r)
+{
+  ts->in_burst = 0;
+  ts->left = (t->burst > 0) ? expo(r, t->burst_off) : 0;
+}
+
+/* Exponential gaps are memoryless, so when a gap runs past the end of a
+   period, we can move to the next period and draw again from there. */
+
+double traffic_gap(Traffic *t, Traffic_State *ts, Rng *r, double interarrival)
+{
+  double gap, x;
+
+  if (t->burst <= 0) return expo(r, interarrival);
+  gap = 0;
+  while (1) {
+    x = expo(r, ts->in_burst ? interarrival / t->burst : interarrival);
+    if (x < ts->left) {
+      ts->left -= x;
+      return gap + x;
+    }
+    gap += ts->left;
+    ts->in_burst = !ts->in_burst;
+    ts->left = expo(r, ts->in_burst ? t->burst_on : t->burst_off);
+  }
+}
+
+/* A floor from lo to nfloors: uniformly, or in proportion to the weights,
+   by binary search on their running sums. */
+
+static int pick(Traffic *t, Rng *r, int nfloors, int lo)
+{
+  double x;
+  int l, h, m;
+
+  if (t->cum == NULL) return rng_int(r, nfloors-lo+1) + lo;
+  x = t->cum[lo-1] + rng_double(r) * (t->cum[nfloors] - t->cum[lo-1]);
+  l = lo;
+  h = nfloors;
+  while (l < h) {
+    m = (l + h) / 2;
+    if (t->cum[m] > x) h = m; else l = m+1;
+  }
+  return l;
+}
+
+void traffic_trip(Traffic *t, Rng *r, int nfloors, int *from, int *to)
+{
+  double perc;
+
+  perc = rng_double(r);
+  if (perc < t->up) {
+    *from = 1;
+    *to = pick(t, r, nfloors, 2);
+  } else if (perc < t->up + t->down) {
+    *from = pick(t, r, nfloors, 2);
+    *to = 1;
+  } else {
+    *from = pick(t, r, nfloors, 1);
+    do {
+      *to = pick(t, r, nfloors, 1);
+    } while (*from == *to);
+  }
+}
@@ -0,0 +1,70 @@
+/* traffic.h
+   Traffic profiles for person_gen(): where people go, and how bursty
+   their arrivals are.
+
+   A trip is either up from the lobby (floor 1), down to the lobby, or
+   between two other floors.  The profile gives the fractions of the
+   first two; the rest are interfloor:
+
+     uniform   1/3 up, 1/3 down (the default, and the original model)
+     up        Morning up-peak: 85% up, 5% down
+     down      Evening down-peak: 5% up, 85% down
+     lunch     Two-way lunch traffic: 40% up, 40% down
+     u,d       Any other split, e.g. 0.6,0.3
+
+   Floor weights ("w1,w2,...,wn", one per floor) make some floors busier
+   than others: the floor at the far end of a lobby trip, and both floors
+   of an interfloor trip, are chosen in proportion to them.  Without
+   them, floors are chosen uniformly.
+
+   Bursts ("k,on,off") make arrivals a Markov-modulated Poisson process:
+   quiet periods with the usual interarrival time, averaging off seconds,
+   alternate with bursts averaging on seconds, in which people arrive k
+   times as fast.  Both lengths are exponential.
+
+   A Traffic is only read once it is set up, so any number of simulations
+   may share one.  Each generator keeps its own Traffic_State.
+ */
+
+#ifndef _TRAFFIC_H_
+#define _TRAFFIC_H_
+
+#include "rng.h"
+
+typedef struct {
+  double up;                  /* Fraction of trips up from the lobby */
+  double down;                /* Fraction of trips down to the lobby */
+  int nfloors;                /* Of the weights, or 0 for none */
+  double *cum;                /* cum[i] = w1 + ... + wi, for i in 0..nfloors */
+  double burst;               /* Rate multiplier in bursts, or 0 for no bursts */
+  double burst_on;            /* Mean length of a burst */
+  double burst_off;           /* Mean time between bursts */
+} Traffic;
+
+typedef struct {
+  int in_burst;
+  double left;                /* Time left in the current period */
+} Traffic_State;
+
+/* These set up t from the command line, returning 0 if s is bad. */
+
+extern void traffic_init(Traffic *t);                         /* The default */
+extern int traffic_profile(Traffic *t, char *s);
+extern int traffic_weights(Traffic *t, char *s);
+extern int traffic_bursts(Traffic *t, char *s);
+
+/* Returns 0 if the weights don't fit a building of nfloors floors. */
+
+extern int traffic_check(Traffic *t, int nfloors);
+
+/* The time to the next arrival, with a mean of interarrival outside of
+   bursts, drawn from r. */
+
+extern void traffic_start(Traffic *t, Traffic_State *ts, Rng *r);
+extern double traffic_gap(Traffic *t, Traffic_State *ts, Rng *r, double interarrival);
+
+/* Picks the floors of a trip in a building of nfloors floors, from r. */
+
+extern void traffic_trip(Traffic *t, Rng *r, int nfloors, int *from, int *to);
+
+#endif